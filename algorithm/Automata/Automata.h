@@ -16,11 +16,1375 @@
 #include <unordered_map>
 #include <set>
 #include <unordered_set>
+#include <map>
+#include <algorithm>
+#include <array>
+#include <string_view>
+#include <thread>
+#include <iterator>
+#include <optional>
+#include <cstring>
+#include <memory>
+#include <atomic>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define __COMPILER_AUTOMATA_X86_
+#endif
+
+namespace Automata {
+    class DFA;
+    class AhoCorasick;
+    class CompressedMatcher;
+    class Product;
+    class Regex;
+    class JITMatcher;
+    class IncrementalDFA;
+
+    /*
+     * 编译后的DFA: 稠密转移表
+     * 状态用从0开始的整数编号 其中0固定为死状态(对应DFA中的孤岛状态"")
+     * 输入字节先映射到等价类 转移表按 状态 × 等价类 展开
+     * 编译后的对象只读 匹配时不分配内存
+     */
+    class Matcher {
+        friend class DFA;
+        friend class AhoCorasick;
+        friend class CompressedMatcher;
+        friend class Product;
+        friend class JITMatcher;
+        friend class IncrementalDFA;
+
+    public:
+        using State = int;
+        // 死状态 一旦进入就不会再离开
+        static constexpr State DEAD = 0;
+
+    private:
+        // 并行匹配时每个分块的最小字节数 太小的分块不值得开线程
+        static constexpr std::size_t _PARALLEL_MIN_CHUNK = 1 << 16;
+        // 状态数不超过该值时使用shuffle内核
+        static constexpr int _SHUFFLE_MAX_STATES = 16;
+        // 输入短于该值时shuffle内核的收益抵不上最后的取值
+        static constexpr std::size_t _SHUFFLE_MIN_INPUT = 16;
+        // 前缀字面量的最大长度
+        static constexpr std::size_t _PREFIX_MAX_LENGTH = 16;
+        // 首字节集合不超过该大小时使用SIMD逐字节比较
+        static constexpr int _FIRST_BYTES_SIMD_MAX = 3;
+
+        // 16个状态的转移函数: f[s]表示从状态s出发到达的状态
+        using _Function = std::array<unsigned char, _SHUFFLE_MAX_STATES>;
+
+        // 状态数(含死状态)
+        int _stateNum = 1;
+        // 字节等价类数
+        int _classNum = 1;
+        // 开始状态
+        State _start = DEAD;
+        // 字节 → 等价类
+        std::array<unsigned char, 256> _classes {};
+        // 转移表: _table[state * _classNum + class]
+        std::vector<State> _table = std::vector<State>(1, DEAD);
+        // 终态标记
+        std::vector<char> _accept = std::vector<char>(1, false);
+        // 多模式匹配时每个状态接受的模式编号(升序) 编号越小优先级越高
+        std::vector<std::vector<int> > _patterns = std::vector<std::vector<int> >(1);
+        // 小DFA的shuffle表: _shuffle[class][s] = next(s, class) 状态数超过16时为空
+        std::vector<_Function> _shuffle;
+        // 搜索时的预过滤: 任何匹配都必须以_prefix开头
+        std::string _prefix;
+        // 搜索时的预过滤: 能够从开始状态转移出去的字节
+        std::array<bool, 256> _firstBytes {};
+        std::vector<unsigned char> _firstList;
+
+        // 根据转移表生成各个执行内核需要的辅助表
+        void _prepare() {
+            _prepareShuffle();
+            _preparePrefilter();
+        }
+
+        void _prepareShuffle() {
+            _shuffle.clear();
+            if (_stateNum > _SHUFFLE_MAX_STATES) {
+                return;
+            }
+
+            _shuffle.assign(_classNum, _Function());
+            for (int c = 0; c < _classNum; ++c) {
+                // 多出来的位置填死状态 使得复合后仍然封闭
+                for (int s = 0; s < _SHUFFLE_MAX_STATES; ++s) {
+                    _shuffle[c][s] = static_cast<unsigned char>(
+                        s < _stateNum ? _table[s * _classNum + c] : DEAD);
+                }
+            }
+        }
+
+        /*
+         * 从开始状态分析预过滤条件
+         * 1. 只要当前状态不是终态 且只有一个字节能转移到活状态 这个字节就是所有匹配的必经前缀
+         * 2. 开始状态能接受的所有首字节
+         */
+        void _preparePrefilter() {
+            _prefix.clear();
+            _firstBytes.fill(false);
+            _firstList.clear();
+
+            for (int ch = 0; ch < 256; ++ch) {
+                if (next(_start, static_cast<unsigned char>(ch)) != DEAD) {
+                    _firstBytes[ch] = true;
+                    _firstList.push_back(static_cast<unsigned char>(ch));
+                }
+            }
+
+            auto s = _start;
+            while (!isAccept(s) && _prefix.size() < _PREFIX_MAX_LENGTH) {
+                auto only = -1;
+                for (int ch = 0; ch < 256; ++ch) {
+                    if (next(s, static_cast<unsigned char>(ch)) == DEAD) {
+                        continue;
+                    }
+                    if (only != -1) {
+                        only = -2;
+                        break;
+                    }
+                    only = ch;
+                }
+
+                if (only < 0) {
+                    break;
+                }
+                _prefix += static_cast<char>(only);
+                s = next(s, static_cast<unsigned char>(only));
+            }
+        }
+
+#ifdef __COMPILER_AUTOMATA_X86_
+        // SSE2: 每次比较16个字节 找到第一个属于_firstList的字节
+        std::size_t _findFirstSSE2(std::string_view text, std::size_t pos) const {
+            __m128i needles[_FIRST_BYTES_SIMD_MAX];
+            auto count = _firstList.size();
+            for (std::size_t i = 0; i < count; ++i) {
+                needles[i] = _mm_set1_epi8(static_cast<char>(_firstList[i]));
+            }
+
+            for (; pos + 16 <= text.size(); pos += 16) {
+                auto block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text.data() + pos));
+                auto hit = _mm_cmpeq_epi8(block, needles[0]);
+                for (std::size_t i = 1; i < count; ++i) {
+                    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, needles[i]));
+                }
+                if (auto mask = _mm_movemask_epi8(hit); mask != 0) {
+                    return pos + __builtin_ctz(mask);
+                }
+            }
+
+            for (; pos < text.size(); ++pos) {
+                if (_firstBytes[static_cast<unsigned char>(text[pos])]) {
+                    return pos;
+                }
+            }
+            return std::string_view::npos;
+        }
+#endif
+
+        // 返回pos之后第一个可能开始匹配的位置
+        std::size_t _candidate(std::string_view text, std::size_t pos) const {
+            // 开始状态就是终态: 每个位置都有空匹配
+            if (isAccept(_start)) {
+                return pos;
+            }
+            if (_prefix.size() > 1) {
+                return text.find(_prefix, pos);
+            }
+            if (_firstList.empty() || pos >= text.size()) {
+                return std::string_view::npos;
+            }
+            if (_firstList.size() == 1) {
+                auto hit = std::memchr(text.data() + pos, _firstList[0], text.size() - pos);
+                return hit ? static_cast<const char *>(hit) - text.data() : std::string_view::npos;
+            }
+#ifdef __COMPILER_AUTOMATA_X86_
+            if (_firstList.size() <= _FIRST_BYTES_SIMD_MAX) {
+                return _findFirstSSE2(text, pos);
+            }
+#endif
+            for (; pos < text.size(); ++pos) {
+                if (_firstBytes[static_cast<unsigned char>(text[pos])]) {
+                    return pos;
+                }
+            }
+            return std::string_view::npos;
+        }
+
+        static _Function _identity() {
+            auto res = _Function();
+            for (int s = 0; s < _SHUFFLE_MAX_STATES; ++s) {
+                res[s] = static_cast<unsigned char>(s);
+            }
+            return res;
+        }
+
+        static bool _hasSSSE3() {
+#ifdef __COMPILER_AUTOMATA_X86_
+            static const bool res = __builtin_cpu_supports("ssse3");
+            return res;
+#else
+            return false;
+#endif
+        }
+
+#ifdef __COMPILER_AUTOMATA_X86_
+        // f ← shuffle(T[class], f) 即 f'[s] = T[class][f[s]]
+        // 依赖链上只有一条1周期的pshufb 查表的load不在依赖链上
+        __attribute__((target("ssse3")))
+        _Function _composeSSSE3(_Function f, std::string_view input) const {
+            auto fn = _mm_loadu_si128(reinterpret_cast<const __m128i *>(f.data()));
+            for (const auto ch: input) {
+                auto t = _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+                    _shuffle[_classes[static_cast<unsigned char>(ch)]].data()));
+                fn = _mm_shuffle_epi8(t, fn);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(f.data()), fn);
+            return f;
+        }
+#endif
+
+        // 将转移函数f与input上的转移复合
+        _Function _compose(_Function f, std::string_view input) const {
+#ifdef __COMPILER_AUTOMATA_X86_
+            if (_hasSSSE3()) {
+                return _composeSSSE3(f, input);
+            }
+#endif
+            for (const auto ch: input) {
+                const auto &t = _shuffle[_classes[static_cast<unsigned char>(ch)]];
+                for (auto &s: f) {
+                    s = t[s];
+                }
+            }
+            return f;
+        }
+
+        // 从每个状态出发推测地运行一个分块 得到 状态 → 状态 的映射
+        // 多个起点收敛到同一状态后只需继续运行一次
+        std::vector<State> _speculate(std::string_view chunk) const {
+            // 小DFA: 一次复合就得到所有起点的映射
+            if (!_shuffle.empty()) {
+                auto f = _compose(_identity(), chunk);
+                return std::vector<State>(f.begin(), f.begin() + _stateNum);
+            }
+
+            // lane: 当前仍在运行的不同状态
+            auto lanes = std::vector<State>();
+            // 每个起点对应的lane下标
+            auto laneOf = std::vector<int>(_stateNum, 0);
+            for (State s = 0; s < _stateNum; ++s) {
+                laneOf[s] = static_cast<int>(lanes.size());
+                lanes.push_back(s);
+            }
+
+            auto merged = std::vector<int>(_stateNum, -1);
+            for (std::size_t pos = 0; pos < chunk.size(); ) {
+                // 每64个字节合并一次已经收敛的lane
+                auto end = std::min(chunk.size(), pos + 64);
+                for (auto &lane: lanes) {
+                    lane = run(lane, chunk.substr(pos, end - pos));
+                }
+                pos = end;
+
+                auto collapsed = std::vector<State>();
+                auto remap = std::vector<int>(lanes.size(), 0);
+                for (std::size_t i = 0; i < lanes.size(); ++i) {
+                    if (merged[lanes[i]] == -1) {
+                        merged[lanes[i]] = static_cast<int>(collapsed.size());
+                        collapsed.push_back(lanes[i]);
+                    }
+                    remap[i] = merged[lanes[i]];
+                }
+                for (const auto s: collapsed) {
+                    merged[s] = -1;
+                }
+                for (auto &l: laneOf) {
+                    l = remap[l];
+                }
+                lanes.swap(collapsed);
+            }
+
+            auto res = std::vector<State>(_stateNum, DEAD);
+            for (State s = 0; s < _stateNum; ++s) {
+                res[s] = lanes[laneOf[s]];
+            }
+            return res;
+        }
+
+    public:
+        Matcher() = default;
+        ~Matcher() { }
+
+        State start() const { return _start; }
+
+        int size() const { return _stateNum; }
+
+        // 转移表占用的字节数
+        std::size_t memory() const { return _table.size() * sizeof(State); }
+
+        bool isAccept(State s) const { return _accept[s]; }
+
+        // 状态s接受的所有模式编号 第一个即优先级最高的模式
+        const std::vector<int> &patterns(State s) const { return _patterns[s]; }
+
+        // 单步转移
+        State next(State s, unsigned char ch) const {
+            return _table[s * _classNum + _classes[ch]];
+        }
+
+        // 从状态s开始读完整个input 返回最终状态
+        // 状态数不超过16且CPU支持SSSE3时自动使用shuffle内核
+        State run(State s, std::string_view input) const {
+            if (!_shuffle.empty() && _hasSSSE3() && input.size() >= _SHUFFLE_MIN_INPUT) {
+                return _compose(_identity(), input)[s];
+            }
+
+            for (const auto ch: input) {
+                s = next(s, static_cast<unsigned char>(ch));
+            }
+            return s;
+        }
+
+        // 整个input是否被DFA接受
+        bool match(std::string_view input) const {
+            return isAccept(run(_start, input));
+        }
+
+        // 一次扫描 返回整个input匹配的所有模式编号
+        const std::vector<int> &matchPatterns(std::string_view input) const {
+            return patterns(run(_start, input));
+        }
+
+        /*
+         * 在text中从from开始搜索匹配
+         * 返回起点最左的匹配[begin, end) 同一起点取最长的匹配 没有匹配时返回nullopt
+         * 先用预过滤跳到可能的起点 只在候选位置运行DFA
+         */
+        std::optional<std::pair<std::size_t, std::size_t> > search(
+            std::string_view text, std::size_t from = 0) const {
+            if (from > text.size()) {
+                return std::nullopt;
+            }
+
+            for (auto pos = _candidate(text, from); pos != std::string_view::npos;
+                pos = _candidate(text, pos + 1)) {
+                auto s = _start;
+                auto end = isAccept(s) ? std::make_optional(pos) : std::nullopt;
+
+                for (auto i = pos; i < text.size() && s != DEAD; ) {
+                    s = next(s, static_cast<unsigned char>(text[i++]));
+                    if (isAccept(s)) {
+                        end = i;
+                    }
+                }
+
+                if (end.has_value()) {
+                    return std::make_pair(pos, end.value());
+                }
+                if (pos >= text.size()) {
+                    break;
+                }
+            }
+
+            return std::nullopt;
+        }
+
+        /*
+         * 扫描input 每读入一个字节后若当前状态带有模式编号
+         * 就对每个编号调用 report(end, pattern) 其中end是已读入的字节数
+         * 对AhoCorasick编译出的Matcher 这恰好报告了每一个关键字的出现位置
+         */
+        template<typename Report>
+        void scan(std::string_view input, Report &&report) const {
+            auto s = _start;
+            for (std::size_t i = 0; i < input.size(); ++i) {
+                s = next(s, static_cast<unsigned char>(input[i]));
+                for (const auto pattern: _patterns[s]) {
+                    report(i + 1, pattern);
+                }
+            }
+        }
+
+        /*
+         * 批量匹配多条互相独立的短记录
+         * 单条记录的转移是一串相互依赖的load 延迟无法隐藏
+         * 这里让K条记录同步前进 每一步交错地查K次表 使CPU可以重叠访存延迟
+         * 1. K个lane各装入一条记录
+         * 2. 所有lane轮流前进一步
+         * 3. 读完的记录写回结果 并立即从剩下的记录中补充该lane
+         * 返回每条记录是否被接受
+         */
+        template<std::size_t K = 8>
+        std::vector<char> matchBatch(const std::vector<std::string_view> &records) const {
+            auto res = std::vector<char>(records.size(), false);
+
+            std::array<State, K> state;
+            std::array<const char *, K> cur;
+            std::array<std::size_t, K> remain, id;
+            std::size_t nextRecord = 0, active = 0;
+
+            // 给lane k装入下一条非空记录 没有记录可装时返回false
+            auto refill = [&](std::size_t k) {
+                for (; nextRecord < records.size(); ++nextRecord) {
+                    if (records[nextRecord].empty()) {
+                        res[nextRecord] = isAccept(_start);
+                        continue;
+                    }
+                    state[k] = _start;
+                    cur[k] = records[nextRecord].data();
+                    remain[k] = records[nextRecord].size();
+                    id[k] = nextRecord++;
+                    return true;
+                }
+                return false;
+            };
+
+            while (active < K && refill(active)) {
+                ++active;
+            }
+
+            while (active > 0) {
+                for (std::size_t k = 0; k < active; ) {
+                    state[k] = next(state[k], static_cast<unsigned char>(*cur[k]++));
+                    if (--remain[k] != 0) {
+                        ++k;
+                        continue;
+                    }
+
+                    res[id[k]] = isAccept(state[k]);
+                    if (!refill(k)) {
+                        // 没有新记录 用最后一个活动lane填补空位
+                        --active;
+                        state[k] = state[active];
+                        cur[k] = cur[active];
+                        remain[k] = remain[active];
+                        id[k] = id[active];
+                    } else {
+                        ++k;
+                    }
+                }
+            }
+
+            return res;
+        }
+
+        /*
+         * 数据并行的推测匹配
+         * 1. 将输入切成threads块
+         * 2. 第一块从开始状态正常运行 其余每块从所有状态出发推测运行 得到状态映射
+         * 3. 按块的顺序对映射做前缀扫描 得到准确的最终状态
+         * 对最小化后的小DFA 推测的代价很快随着lane的收敛而消失
+         */
+        State parallelRun(std::string_view input,
+            unsigned threads = std::thread::hardware_concurrency()) const {
+            auto maxChunks = input.size() / _PARALLEL_MIN_CHUNK;
+            std::size_t chunks = std::min<std::size_t>(std::max(threads, 1u), maxChunks);
+            if (chunks <= 1) {
+                return run(_start, input);
+            }
+
+            auto chunkSize = input.size() / chunks;
+            auto maps = std::vector<std::vector<State> >(chunks);
+            auto workers = std::vector<std::thread>();
+            State first = DEAD;
+
+            for (std::size_t i = 1; i < chunks; ++i) {
+                auto begin = i * chunkSize;
+                auto len = (i == chunks - 1) ? input.size() - begin : chunkSize;
+                workers.emplace_back([this, &maps, i, chunk = input.substr(begin, len)] {
+                    maps[i] = _speculate(chunk);
+                });
+            }
+            first = run(_start, input.substr(0, chunkSize));
+            for (auto &t: workers) {
+                t.join();
+            }
+
+            // 前缀扫描: 依次复合每一块的映射
+            for (std::size_t i = 1; i < chunks; ++i) {
+                first = maps[i][first];
+            }
+            return first;
+        }
+
+        bool parallelMatch(std::string_view input,
+            unsigned threads = std::thread::hardware_concurrency()) const {
+            return isAccept(parallelRun(input, threads));
+        }
+
+        // 插桩运行: 统计从开始状态读入input时每个状态被访问的次数 累加到visits
+        void profile(std::string_view input, std::vector<std::size_t> &visits) const {
+            visits.resize(_stateNum, 0);
+
+            auto s = _start;
+            ++visits[s];
+            for (const auto ch: input) {
+                s = next(s, static_cast<unsigned char>(ch));
+                ++visits[s];
+            }
+        }
+
+        /*
+         * 按访问频率重新编号状态 使热状态和它常用的后继落在相邻的缓存行中
+         * 1. 死状态仍然编号0
+         * 2. 有profile时 按访问次数从高到低取状态 每取一个状态就紧接着放入它被访问过的后继
+         *    后继之间同样按访问次数从高到低排列
+         * 3. 剩下的状态(或没有profile时的全部状态) 按从开始状态出发的BFS序编号
+         * 返回重新编号后的Matcher 匹配结果不变
+         */
+        Matcher relayout(const std::vector<std::size_t> &visits = {}) const {
+            auto order = std::vector<State>({ DEAD });
+            auto placed = std::vector<char>(_stateNum, false);
+            placed[DEAD] = true;
+
+            auto place = [&order, &placed](State s) {
+                if (!placed[s]) {
+                    placed[s] = true;
+                    order.push_back(s);
+                }
+            };
+            auto hotter = [&visits](State a, State b) {
+                return visits[a] > visits[b];
+            };
+
+            if (visits.size() == static_cast<std::size_t>(_stateNum)) {
+                auto hot = std::vector<State>();
+                for (State s = 1; s < _stateNum; ++s) {
+                    if (visits[s] > 0) {
+                        hot.push_back(s);
+                    }
+                }
+                std::stable_sort(hot.begin(), hot.end(), hotter);
+
+                for (const auto s: hot) {
+                    place(s);
+
+                    auto successors = std::vector<State>();
+                    for (int c = 0; c < _classNum; ++c) {
+                        if (auto t = _table[s * _classNum + c]; visits[t] > 0) {
+                            successors.push_back(t);
+                        }
+                    }
+                    std::stable_sort(successors.begin(), successors.end(), hotter);
+                    for (const auto t: successors) {
+                        place(t);
+                    }
+                }
+            }
+
+            auto q = std::queue<State>();
+            auto seen = std::vector<char>(_stateNum, false);
+            seen[DEAD] = seen[_start] = true;
+            for (q.push(_start); !q.empty(); q.pop()) {
+                auto s = q.front();
+                place(s);
+                for (int c = 0; c < _classNum; ++c) {
+                    if (auto t = _table[s * _classNum + c]; !seen[t]) {
+                        seen[t] = true;
+                        q.push(t);
+                    }
+                }
+            }
+            // 从开始状态不可达的状态放在最后
+            for (State s = 1; s < _stateNum; ++s) {
+                place(s);
+            }
+
+            auto id = std::vector<State>(_stateNum);
+            for (State i = 0; i < _stateNum; ++i) {
+                id[order[i]] = i;
+            }
+
+            auto res = *this;
+            res._start = id[_start];
+            for (State i = 0; i < _stateNum; ++i) {
+                auto s = order[i];
+                for (int c = 0; c < _classNum; ++c) {
+                    res._table[i * _classNum + c] = id[_table[s * _classNum + c]];
+                }
+                res._accept[i] = _accept[s];
+                res._patterns[i] = _patterns[s];
+            }
+            res._prepare();
+
+            return res;
+        }
+    };
+
+    /*
+     * 多线程共享的Matcher 支持原子地热替换成新版本
+     * 持有的Matcher在发布前已经完全构造好 发布后不再修改
+     * 读者通过load()取得一个引用计数的快照 整个匹配过程都使用同一个版本 不需要加锁
+     * 旧版本在最后一个持有快照的读者释放后才析构
+     */
+    class SharedMatcher {
+    private:
+        std::shared_ptr<const Matcher> _current;
+
+    public:
+        SharedMatcher(): _current(std::make_shared<const Matcher>()) { }
+        SharedMatcher(Matcher matcher):
+            _current(std::make_shared<const Matcher>(std::move(matcher))) { }
+        SharedMatcher(std::shared_ptr<const Matcher> matcher): _current(std::move(matcher)) { }
+        ~SharedMatcher() { }
+
+        SharedMatcher(const SharedMatcher &) = delete;
+        SharedMatcher &operator=(const SharedMatcher &) = delete;
+
+        // 取得当前版本的快照
+        std::shared_ptr<const Matcher> load() const {
+            return std::atomic_load_explicit(&_current, std::memory_order_acquire);
+        }
+
+        // 发布新版本 正在使用旧快照的读者不受影响
+        void store(std::shared_ptr<const Matcher> matcher) {
+            std::atomic_store_explicit(&_current, std::move(matcher), std::memory_order_release);
+        }
+
+        void store(Matcher matcher) {
+            store(std::make_shared<const Matcher>(std::move(matcher)));
+        }
+    };
+
+    /*
+     * 行位移压缩(comb vector)的转移表 即yacc/flex的base/next/check数组
+     * 每个状态只保存到活状态的转移 各行错开位移后叠放在同一个向量中
+     * 查表: idx = base[s] + class 若check[idx] == s 则转移到next[idx] 否则到死状态
+     * 查表仍然是O(1) 对状态多、字母表小、大部分转移到死状态的DFA能大幅节省内存
+     */
+    class CompressedMatcher {
+    public:
+        using State = Matcher::State;
+        static constexpr State DEAD = Matcher::DEAD;
+
+    private:
+        int _stateNum;
+        State _start;
+        std::array<unsigned char, 256> _classes;
+        std::vector<int> _base;
+        std::vector<State> _next;
+        std::vector<State> _check;
+        std::vector<char> _accept;
+
+    public:
+        /*
+         * 从稠密表压缩
+         * 1. 按活转移数从多到少依次放置每一行 稠密的行先放更容易找到位置
+         * 2. 每行取最小的base 使得该行所有活转移的位置都还没有被占用
+         */
+        CompressedMatcher(const Matcher &dense):
+            _stateNum(dense._stateNum), _start(dense._start),
+            _classes(dense._classes), _base(dense._stateNum, 0), _accept(dense._accept) {
+            const auto classNum = dense._classNum;
+            auto rows = std::vector<std::vector<int> >(_stateNum);
+            for (State s = 0; s < _stateNum; ++s) {
+                for (int c = 0; c < classNum; ++c) {
+                    if (dense._table[s * classNum + c] != DEAD) {
+                        rows[s].push_back(c);
+                    }
+                }
+            }
+
+            auto order = std::vector<State>(_stateNum);
+            for (State s = 0; s < _stateNum; ++s) {
+                order[s] = s;
+            }
+            std::stable_sort(order.begin(), order.end(), [&rows](State a, State b) {
+                return rows[a].size() > rows[b].size();
+            });
+
+            // 每放一行都保证向量至少延伸到base + classNum 查表时不会越界
+            auto used = std::vector<char>();
+            // 第一个可能空闲的位置 在它之前的位置都已被占用
+            std::size_t firstFree = 0;
+            for (const auto s: order) {
+                if (rows[s].empty()) {
+                    continue;
+                }
+
+                while (firstFree < used.size() && used[firstFree]) {
+                    ++firstFree;
+                }
+                auto base = static_cast<int>(firstFree) - rows[s].front();
+                for (;; ++base) {
+                    if (base < 0) {
+                        continue;
+                    }
+
+                    auto fit = true;
+                    for (const auto c: rows[s]) {
+                        if (static_cast<std::size_t>(base + c) < used.size() && used[base + c]) {
+                            fit = false;
+                            break;
+                        }
+                    }
+                    if (fit) {
+                        break;
+                    }
+                }
+
+                _base[s] = base;
+                if (used.size() < static_cast<std::size_t>(base + classNum)) {
+                    used.resize(base + classNum, false);
+                    _next.resize(base + classNum, DEAD);
+                    _check.resize(base + classNum, DEAD);
+                }
+                for (const auto c: rows[s]) {
+                    used[base + c] = true;
+                    _next[base + c] = dense._table[s * classNum + c];
+                    _check[base + c] = s;
+                }
+            }
+
+            // 没有活转移的行base为0 保证它们的查表也不越界
+            // 空位的next和check都是死状态 死状态自己查到的仍是死状态
+            if (_next.size() < static_cast<std::size_t>(classNum)) {
+                _next.resize(classNum, DEAD);
+                _check.resize(classNum, DEAD);
+            }
+        }
+        ~CompressedMatcher() { }
+
+        State start() const { return _start; }
+
+        int size() const { return _stateNum; }
+
+        bool isAccept(State s) const { return _accept[s]; }
+
+        // 压缩表占用的字节数
+        std::size_t memory() const {
+            return _base.size() * sizeof(int) + (_next.size() + _check.size()) * sizeof(State);
+        }
+
+        State next(State s, unsigned char ch) const {
+            auto idx = _base[s] + _classes[ch];
+            return _check[idx] == s ? _next[idx] : DEAD;
+        }
+
+        State run(State s, std::string_view input) const {
+            for (const auto ch: input) {
+                s = next(s, static_cast<unsigned char>(ch));
+            }
+            return s;
+        }
+
+        bool match(std::string_view input) const {
+            return isAccept(run(_start, input));
+        }
+    };
+
+    /*
+     * 两个编译后DFA的惰性乘积自动机
+     * 乘积状态是一对状态(a, b) 只在需要时才计算转移 不预先构造 |A| × |B| 的表
+     * 支持交、并、差、对称差 判空时只探索可达的乘积状态 找到终态立即返回
+     * Product只保存两个Matcher的引用 使用期间它们必须存活
+     */
+    class Product {
+    public:
+        enum class Operation {
+            INTERSECTION,
+            UNION,
+            DIFFERENCE,             // A - B
+            SYMMETRIC_DIFFERENCE,
+        };
+
+        using State = std::pair<Matcher::State, Matcher::State>;
+
+    private:
+        // 为std::pair定义hash
+        struct _hash {
+            std::size_t operator()(const State &p) const {
+                return std::hash<long long>{}(
+                    (static_cast<long long>(p.first) << 32) ^ static_cast<long long>(p.second));
+            }
+        };
+
+        const Matcher &_lhs;
+        const Matcher &_rhs;
+        Operation _op;
+        // 乘积的字节等价类: 两边等价类组成的每一种不同的组合
+        std::array<unsigned char, 256> _classes;
+        // 每个乘积等价类的代表字节
+        std::vector<unsigned char> _representative;
+
+        // 按遍历顺序给可达的乘积状态编号 返回编号 → 乘积状态
+        std::vector<State> _reachable(
+            std::unordered_map<State, Matcher::State, _hash> &id) const {
+            auto states = std::vector<State>({ { Matcher::DEAD, Matcher::DEAD } });
+            id[states.front()] = Matcher::DEAD;
+
+            auto q = std::queue<State>();
+            if (id.find(start()) == id.end()) {
+                id[start()] = static_cast<Matcher::State>(states.size());
+                states.push_back(start());
+            }
+            for (q.push(start()); !q.empty(); q.pop()) {
+                auto s = q.front();
+                for (const auto ch: _representative) {
+                    if (auto t = next(s, ch); id.find(t) == id.end()) {
+                        id[t] = static_cast<Matcher::State>(states.size());
+                        states.push_back(t);
+                        q.push(t);
+                    }
+                }
+            }
+
+            return states;
+        }
+
+    public:
+        Product(const Matcher &lhs, const Matcher &rhs, Operation op):
+            _lhs(lhs), _rhs(rhs), _op(op) {
+            auto pair2Class = std::map<std::pair<int, int>, int>();
+            for (int ch = 0; ch < 256; ++ch) {
+                auto key = std::make_pair(lhs._classes[ch], rhs._classes[ch]);
+                if (pair2Class.find(key) == pair2Class.end()) {
+                    pair2Class[key] = static_cast<int>(_representative.size());
+                    _representative.push_back(static_cast<unsigned char>(ch));
+                }
+                _classes[ch] = static_cast<unsigned char>(pair2Class[key]);
+            }
+        }
+        ~Product() { }
+
+        State start() const { return { _lhs.start(), _rhs.start() }; }
+
+        State next(const State &s, unsigned char ch) const {
+            return { _lhs.next(s.first, ch), _rhs.next(s.second, ch) };
+        }
+
+        bool isAccept(const State &s) const {
+            auto a = _lhs.isAccept(s.first), b = _rhs.isAccept(s.second);
+            switch (_op) {
+                case Operation::INTERSECTION:
+                    return a && b;
+                case Operation::UNION:
+                    return a || b;
+                case Operation::DIFFERENCE:
+                    return a && !b;
+                case Operation::SYMMETRIC_DIFFERENCE:
+                    return a != b;
+            }
+            return false;
+        }
+
+        State run(State s, std::string_view input) const {
+            for (const auto ch: input) {
+                s = next(s, static_cast<unsigned char>(ch));
+            }
+            return s;
+        }
+
+        bool match(std::string_view input) const {
+            return isAccept(run(start(), input));
+        }
+
+        // 判空: BFS可达的乘积状态 遇到终态立即返回false 不构造乘积
+        bool isEmpty() const {
+            auto vis = std::unordered_set<State, _hash>({ start() });
+            auto q = std::queue<State>();
+            for (q.push(start()); !q.empty(); q.pop()) {
+                auto s = q.front();
+                if (isAccept(s)) {
+                    return false;
+                }
+                for (const auto ch: _representative) {
+                    if (auto t = next(s, ch); vis.insert(t).second) {
+                        q.push(t);
+                    }
+                }
+            }
+            return true;
+        }
+
+        /*
+         * 物化成Matcher 以便继续参与组合或使用其他执行内核
+         * 1. 只构造从开始状态可达的乘积状态
+         * 2. 到达不了任何终态的乘积状态并入死状态
+         */
+        Matcher materialize() const {
+            auto id = std::unordered_map<State, Matcher::State, _hash>();
+            auto states = _reachable(id);
+            auto stateNum = static_cast<int>(states.size());
+            auto classNum = static_cast<int>(_representative.size());
+
+            auto table = std::vector<Matcher::State>(stateNum * classNum, Matcher::DEAD);
+            auto reverse = std::vector<std::vector<Matcher::State> >(stateNum);
+            for (int s = 0; s < stateNum; ++s) {
+                for (int c = 0; c < classNum; ++c) {
+                    auto t = id[next(states[s], _representative[c])];
+                    table[s * classNum + c] = t;
+                    reverse[t].push_back(s);
+                }
+            }
+
+            // 反向搜索能到达终态的状态
+            auto live = std::vector<char>(stateNum, false);
+            auto q = std::queue<Matcher::State>();
+            for (int s = 1; s < stateNum; ++s) {
+                if (isAccept(states[s])) {
+                    live[s] = true;
+                    q.push(s);
+                }
+            }
+            for (; !q.empty(); q.pop()) {
+                for (const auto from: reverse[q.front()]) {
+                    if (from != Matcher::DEAD && !live[from]) {
+                        live[from] = true;
+                        q.push(from);
+                    }
+                }
+            }
+
+            // 重新编号 死掉的乘积状态全部映射到死状态
+            auto newId = std::vector<Matcher::State>(stateNum, Matcher::DEAD);
+            auto res = Matcher();
+            res._stateNum = 1;
+            for (int s = 1; s < stateNum; ++s) {
+                if (live[s]) {
+                    newId[s] = res._stateNum++;
+                }
+            }
+
+            res._classNum = classNum;
+            res._classes = _classes;
+            res._start = newId[id[start()]];
+            res._table.assign(res._stateNum * classNum, Matcher::DEAD);
+            res._accept.assign(res._stateNum, false);
+            res._patterns.assign(res._stateNum, std::vector<int>());
+            for (int s = 1; s < stateNum; ++s) {
+                if (!live[s]) {
+                    continue;
+                }
+                for (int c = 0; c < classNum; ++c) {
+                    res._table[newId[s] * classNum + c] = newId[table[s * classNum + c]];
+                }
+                res._accept[newId[s]] = isAccept(states[s]);
+            }
+            res._prepare();
+
+            return res;
+        }
+    };
+
+    /*
+     * 支持增量最小化的可修改DFA
+     * 始终维护所有状态上的等价划分(块) 块之间的转移就是最小DFA
+     * 修改一个状态的转移或终态标记时 只有能到达该状态的状态语言可能改变
+     * 1. 反向BFS求出受影响的状态 把它们移出原来的块 其余状态的划分仍然准确
+     * 2. 在受影响的状态上一起做Moore分割 未受影响的后继按原来的块号参与签名
+     *    互相依赖的状态(如互为后继的环)可以分在同一类
+     * 3. 为每个类找到等价的已有块:
+     *    候选块取自 某个已分好块的后继t 在同一字符类上的前驱 所在的块
+     *    用双模拟判定等价(与DFA::operator==相同的思路) 两边都已分块时直接比较块号
+     * 4. 有类并入已有块时 对剩下的状态重复2和3 直到没有类能并入 再为剩下的每个类新建一个块
+     * 更新的代价与受影响区域的大小成正比 而不是整个自动机
+     * 只有类的后继都未分块时 才退回到扫描所有状态
+     * 只维护终态标记 不区分多模式匹配的模式编号
+     */
+    class IncrementalDFA {
+    public:
+        using State = Matcher::State;
+        static constexpr State DEAD = Matcher::DEAD;
+
+    private:
+        // 尚未分块的状态
+        static constexpr int _PENDING = -1;
+
+        std::array<unsigned char, 256> _classes;
+        // 转移表按列存放: _columns[class][state] 拆分字符类时只需复制一列
+        std::vector<std::vector<State> > _columns;
+        std::vector<char> _accept;
+        State _start;
+        // 前驱: _preds[t][s] = s到t的转移条数
+        std::vector<std::unordered_map<State, int> > _preds;
+        // 状态 → 块号
+        std::vector<int> _block;
+        // 块 → 成员
+        std::vector<std::unordered_set<State> > _members;
+        // 空闲的块号
+        std::vector<int> _freeBlocks;
+
+        State _next(State s, int c) const { return _columns[c][s]; }
+
+        int _newBlock() {
+            if (!_freeBlocks.empty()) {
+                auto res = _freeBlocks.back();
+                _freeBlocks.pop_back();
+                return res;
+            }
+            _members.emplace_back();
+            return static_cast<int>(_members.size()) - 1;
+        }
+
+        void _join(State s, int b) {
+            _block[s] = b;
+            _members[b].insert(s);
+        }
+
+        void _leave(State s) {
+            auto b = _block[s];
+            _members[b].erase(s);
+            if (_members[b].empty()) {
+                _freeBlocks.push_back(b);
+            }
+            _block[s] = _PENDING;
+        }
+
+        // 为字节ch单独分出一个字符类 返回该类
+        int _splitClass(unsigned char ch) {
+            auto c = _classes[ch];
+            auto shared = 0;
+            for (int b = 0; b < 256; ++b) {
+                shared += (_classes[b] == c);
+            }
+            if (shared == 1) {
+                return c;
+            }
+
+            _columns.push_back(_columns[c]);
+            for (State s = 0; s < static_cast<State>(_accept.size()); ++s) {
+                ++_preds[_columns[c][s]][s];
+            }
+            _classes[ch] = static_cast<unsigned char>(_columns.size() - 1);
+            return _classes[ch];
+        }
+
+        // 双模拟: 从(x, y)出发的乘积中不存在接受性不同的状态对 <=> 等价
+        // 用显式栈遍历 状态多时也不会栈溢出
+        bool _bisimilar(State x, State y) const {
+            auto vis = std::unordered_set<long long>();
+            auto stack = std::vector<std::pair<State, State> >({ { x, y } });
+            while (!stack.empty()) {
+                auto [ a, b ] = stack.back();
+                stack.pop_back();
+                if (_block[a] != _PENDING && _block[b] != _PENDING) {
+                    if (_block[a] != _block[b]) {
+                        return false;
+                    }
+                    continue;
+                }
+                if (_accept[a] != _accept[b]) {
+                    return false;
+                }
+                if (a == b || !vis.insert(static_cast<long long>(a) * _accept.size() + b).second) {
+                    continue;
+                }
+
+                for (std::size_t c = 0; c < _columns.size(); ++c) {
+                    stack.emplace_back(_next(a, c), _next(b, c));
+                }
+            }
+            return true;
+        }
+
+        // 为未分块的状态x找到等价的已有块 没有时返回_PENDING
+        int _locate(State x) const {
+            auto candidates = std::vector<int>();
+            auto seen = std::unordered_set<int>();
+            auto add = [&](State y) {
+                if (y != x && _block[y] != _PENDING && _accept[y] == _accept[x]
+                    && seen.insert(_block[y]).second) {
+                    candidates.push_back(_block[y]);
+                }
+            };
+
+            // 选一个已分块的后继 优先选非死状态 死状态的前驱太多
+            auto via = -1;
+            for (std::size_t c = 0; c < _columns.size(); ++c) {
+                auto t = _next(x, c);
+                if (_block[t] == _PENDING) {
+                    continue;
+                }
+                if (via == -1 || _next(x, via) == DEAD) {
+                    via = static_cast<int>(c);
+                }
+            }
+
+            if (via != -1) {
+                for (const auto member: _members[_block[_next(x, via)]]) {
+                    for (const auto &[ pred, count ]: _preds[member]) {
+                        if (_next(pred, via) == member) {
+                            add(pred);
+                        }
+                    }
+                }
+            } else {
+                for (State y = 0; y < static_cast<State>(_accept.size()); ++y) {
+                    add(y);
+                }
+            }
+
+            for (const auto b: candidates) {
+                if (_bisimilar(x, *_members[b].begin())) {
+                    return b;
+                }
+            }
+            return _PENDING;
+        }
+
+        /*
+         * Moore分割未分块的状态 已分块的后继记为块号 未分块的后继记为-1-类号
+         * 返回的类按第一个成员在states中出现的顺序编号
+         * 同一类中的状态一定等价 但与某个已有块等价的状态 会被当作与该块不同
+         */
+        std::vector<std::vector<State> > _split(const std::vector<State> &states) const {
+            auto index = std::unordered_map<State, int>();
+            for (std::size_t i = 0; i < states.size(); ++i) {
+                index[states[i]] = static_cast<int>(i);
+            }
+
+            auto cls = std::vector<int>(states.size());
+            auto clsNum = 0;
+            for (auto changed = true; changed; ) {
+                auto signature2Class = std::map<std::vector<int>, int>();
+                auto next = std::vector<int>(states.size());
+                for (std::size_t i = 0; i < states.size(); ++i) {
+                    auto s = states[i];
+                    auto signature = std::vector<int>({ clsNum == 0 ? _accept[s] : cls[i] });
+                    for (std::size_t c = 0; clsNum != 0 && c < _columns.size(); ++c) {
+                        auto t = _next(s, c);
+                        auto it = index.find(t);
+                        signature.push_back(it == index.end() ? _block[t] : -1 - cls[it->second]);
+                    }
+                    auto id = signature2Class.try_emplace(
+                        std::move(signature), static_cast<int>(signature2Class.size())).first->second;
+                    next[i] = id;
+                }
+                changed = clsNum == 0 || static_cast<int>(signature2Class.size()) != clsNum;
+                clsNum = static_cast<int>(signature2Class.size());
+                cls.swap(next);
+            }
+
+            auto res = std::vector<std::vector<State> >(clsNum);
+            for (std::size_t i = 0; i < states.size(); ++i) {
+                res[cls[i]].push_back(states[i]);
+            }
+            return res;
+        }
+
+        /*
+         * 为未分块的状态重新分块 states按BFS序排列
+         * 未分块的状态的后继要么也在states中 要么已经分好块
+         * 1. 分割未分块的状态 把每个类合并到等价的已有块中
+         * 2. 有类被合并时 剩下的状态的后继信息变多了 回到1重新分割
+         * 3. 没有类能合并时 剩下的状态都不与已有块等价 分割的结果就是它们之间的等价关系
+         *    每个类新建一个块
+         * 每个已有块都含有未受影响的状态 它的后继都已分块 所以_locate不会漏掉等价的块
+         */
+        void _refine(std::vector<State> states) {
+            while (!states.empty()) {
+                auto classes = _split(states);
+                auto rest = std::vector<State>();
+                auto merged = false;
+                for (const auto &members: classes) {
+                    if (auto b = _locate(members.front()); b != _PENDING) {
+                        for (const auto s: members) {
+                            _join(s, b);
+                        }
+                        merged = true;
+                    } else {
+                        rest.insert(rest.end(), members.begin(), members.end());
+                    }
+                }
+
+                if (!merged) {
+                    for (const auto &members: classes) {
+                        auto b = _newBlock();
+                        for (const auto s: members) {
+                            _join(s, b);
+                        }
+                    }
+                    return;
+                }
+                states.swap(rest);
+            }
+        }
+
+        // 状态changed被修改后 重新划分所有能到达它的状态
+        void _update(State changed) {
+            auto affected = std::vector<State>({ changed });
+            auto inAffected = std::unordered_set<State>({ changed });
+            for (std::size_t i = 0; i < affected.size(); ++i) {
+                for (const auto &[ pred, count ]: _preds[affected[i]]) {
+                    if (inAffected.insert(pred).second) {
+                        affected.push_back(pred);
+                    }
+                }
+            }
+
+            for (const auto s: affected) {
+                _leave(s);
+            }
+            _refine(affected);
+        }
+
+        // Moore分割法求初始划分
+        void _partition() {
+            auto n = static_cast<State>(_accept.size());
+            auto block = std::vector<int>(n);
+            auto blockNum = 0;
+            for (auto changed = true; changed; ) {
+                auto signature2Block = std::map<std::vector<int>, int>();
+                auto next = std::vector<int>(n);
+                for (State s = 0; s < n; ++s) {
+                    // 第一轮只按是否终态划分
+                    auto signature = std::vector<int>({ blockNum == 0 ? _accept[s] : block[s] });
+                    for (std::size_t c = 0; blockNum != 0 && c < _columns.size(); ++c) {
+                        signature.push_back(block[_next(s, c)]);
+                    }
+                    auto it = signature2Block.try_emplace(
+                        std::move(signature), static_cast<int>(signature2Block.size())).first;
+                    next[s] = it->second;
+                }
+                changed = blockNum == 0 || static_cast<int>(signature2Block.size()) != blockNum;
+                blockNum = static_cast<int>(signature2Block.size());
+                block.swap(next);
+            }
+
+            _members.assign(blockNum, std::unordered_set<State>());
+            _freeBlocks.clear();
+            _block.assign(n, _PENDING);
+            for (State s = 0; s < n; ++s) {
+                _join(s, block[s]);
+            }
+        }
+
+    public:
+        IncrementalDFA(const Matcher &matcher):
+            _classes(matcher._classes), _accept(matcher._accept), _start(matcher._start) {
+            auto n = matcher._stateNum;
+            _columns.assign(matcher._classNum, std::vector<State>(n, DEAD));
+            _preds.assign(n, std::unordered_map<State, int>());
+            for (State s = 0; s < n; ++s) {
+                for (int c = 0; c < matcher._classNum; ++c) {
+                    auto t = matcher._table[s * matcher._classNum + c];
+                    _columns[c][s] = t;
+                    ++_preds[t][s];
+                }
+            }
+            _partition();
+        }
+        ~IncrementalDFA() { }
+
+        int size() const { return static_cast<int>(_accept.size()); }
+
+        // 最小DFA的状态数(含死状态 也含不可达的块)
+        int blockNum() const { return static_cast<int>(_members.size() - _freeBlocks.size()); }
+
+        int blockOf(State s) const { return _block[s]; }
+
+        State next(State s, unsigned char ch) const { return _next(s, _classes[ch]); }
+
+        bool isAccept(State s) const { return _accept[s]; }
+
+        // 新增一个非终态 所有转移都到死状态 返回其编号
+        State addState() {
+            auto s = static_cast<State>(_accept.size());
+            for (auto &column: _columns) {
+                column.push_back(DEAD);
+            }
+            _accept.push_back(false);
+            _preds.emplace_back();
+            _block.push_back(_PENDING);
+            _preds[DEAD][s] += static_cast<int>(_columns.size());
+            _refine({ s });
+            return s;
+        }
+
+        // 修改终态标记 死状态不能修改
+        void setAccept(State s, bool accept) {
+            if (s == DEAD || static_cast<bool>(_accept[s]) == accept) {
+                return;
+            }
+            _accept[s] = accept;
+            _update(s);
+        }
+
+        // 修改转移 δ(s, ch) = t 死状态不能修改
+        void setTransition(State s, unsigned char ch, State t) {
+            if (s == DEAD || next(s, ch) == t) {
+                return;
+            }
+
+            auto c = _splitClass(ch);
+            auto &old = _preds[_columns[c][s]][s];
+            if (--old == 0) {
+                _preds[_columns[c][s]].erase(s);
+            }
+            _columns[c][s] = t;
+            ++_preds[t][s];
+            _update(s);
+        }
+
+        // 当前(未最小化)的自动机
+        Matcher current() const {
+            auto res = Matcher();
+            res._stateNum = size();
+            res._classNum = static_cast<int>(_columns.size());
+            res._classes = _classes;
+            res._start = _start;
+            res._table.assign(res._stateNum * res._classNum, DEAD);
+            for (State s = 0; s < res._stateNum; ++s) {
+                for (int c = 0; c < res._classNum; ++c) {
+                    res._table[s * res._classNum + c] = _columns[c][s];
+                }
+            }
+            res._accept = _accept;
+            res._patterns.assign(res._stateNum, std::vector<int>());
+            res._prepare();
+            return res;
+        }
+
+        // 按当前划分输出最小DFA 只保留从开始状态可达的块
+        Matcher toMatcher() const {
+            auto id = std::unordered_map<int, State>({ { _block[DEAD], DEAD } });
+            auto reps = std::vector<State>({ DEAD });
+            auto q = std::queue<State>();
+            auto visit = [&](State s) {
+                if (id.find(_block[s]) == id.end()) {
+                    id[_block[s]] = static_cast<State>(reps.size());
+                    reps.push_back(s);
+                    q.push(s);
+                }
+                return id[_block[s]];
+            };
+
+            auto res = Matcher();
+            res._start = visit(_start);
+            for (; !q.empty(); q.pop()) {
+                for (std::size_t c = 0; c < _columns.size(); ++c) {
+                    visit(_next(q.front(), c));
+                }
+            }
+
+            res._stateNum = static_cast<int>(reps.size());
+            res._classNum = static_cast<int>(_columns.size());
+            res._classes = _classes;
+            res._table.assign(res._stateNum * res._classNum, DEAD);
+            res._accept.assign(res._stateNum, false);
+            res._patterns.assign(res._stateNum, std::vector<int>());
+            for (State i = 1; i < res._stateNum; ++i) {
+                for (int c = 0; c < res._classNum; ++c) {
+                    res._table[i * res._classNum + c] = id.at(_block[_next(reps[i], c)]);
+                }
+                res._accept[i] = _accept[reps[i]];
+            }
+            res._prepare();
+            return res;
+        }
+    };
 
-namespace Automata {
     class DFA {
         using _ll = long long;
         friend class NFA;
+        friend class Regex;
 
         // IO
         friend std::istream& operator>>(std::istream& in, DFA &rhs) {
@@ -56,7 +1420,7 @@ namespace Automata {
             return in;
         }
 
-        friend std::ostream& operator<<(std::ostream& out, DFA &rhs) {
+        friend std::ostream& operator<<(std::ostream& out, const DFA &rhs) {
             out << rhs._stateNum << " " << rhs._endNum
                 << " " << rhs._transNum << std::endl;
 
@@ -109,6 +1473,8 @@ namespace Automata {
             std::vector<std::string> _transform;
             // 该状态是否是终态
             bool _isEnd;
+            // 多模式DFA中该终态接受的模式编号
+            std::set<int> _patterns;
 
             _State(bool isEnd = false):
                 _transform(std::vector<std::string>(127, "")), _isEnd(isEnd) { }
@@ -128,15 +1494,16 @@ namespace Automata {
                 }
             };
 
-            std::unordered_map<std::pair<std::string, std::string>, bool, _hash> _visit;
+            // 以两个DFA中状态名的地址作为key 避免复制状态名
+            std::unordered_map<std::pair<const std::string *, const std::string *>, bool, _hash> _visit;
 
         public:
             _Visit() = default;
             ~_Visit() { }
 
-            // getter和setter
+            // getter和setter 未访问过的状态对默认为false
             bool &operator()(const std::string &s1, const std::string &s2) {
-                return _visit[make_pair(s1, s2)];
+                return _visit[std::make_pair(&s1, &s2)];
             }
         };
 
@@ -149,23 +1516,23 @@ namespace Automata {
             ~_StateSet() = default;
 
             // 封装了_set的一些函数
-            auto begin() {
+            auto begin() const {
                 return _set.begin();
             }
 
-            auto end() {
+            auto end() const {
                 return _set.end();
             }
 
-            auto size() {
+            auto size() const {
                 return _set.size();
             }
 
-            auto insert(std::string s) {
+            auto insert(const std::string &s) {
                 return _set.insert(s);
             }
 
-            auto find(std::string s) {
+            auto find(const std::string &s) const {
                 return _set.find(s);
             }
         };
@@ -183,13 +1550,26 @@ namespace Automata {
         // 总转移函数数
         _ll _transNum;
 
-        bool _isEnd(const std::string &s1, const std::string &s2, DFA &rhs) {
+        // 孤岛状态名 查询不存在的状态或转移时返回它的引用
+        static const std::string &_island() {
+            static const std::string res = "";
+            return res;
+        }
+
+        // 状态名在_automata中的key 以它的地址作为状态的唯一标识
+        const std::string &_key(const std::string &state) const {
+            auto it = _automata.find(state);
+            return it == _automata.end() ? _island() : it->first;
+        }
+
+        bool _isEnd(const std::string &s1, const std::string &s2, const DFA &rhs) const {
             // 当且仅当一状态是终态 另一状态非终态 => 两个DFA不等价
-            return _automata[s1]._isEnd ^ rhs._automata[s2]._isEnd;
+            return isEnd(s1) ^ rhs.isEnd(s2);
         }
 
+        // s1和s2是两个DFA中_automata的key
         bool _dfsEqual(const std::string &s1, const std::string &s2,
-            DFA &rhs, _Visit &vis) {
+            const DFA &rhs, _Visit &vis) const {
             if (_isEnd(s1, s2, rhs)) {
                 return true;
             }
@@ -197,8 +1577,8 @@ namespace Automata {
             vis(s1, s2) = true;
 
             for (const auto ch: _charSet) {
-                auto next1 = _automata[s1]._transform[ch];
-                auto next2 = rhs._automata[s2]._transform[ch];
+                const auto &next1 = _key(next(s1, ch));
+                const auto &next2 = rhs._key(rhs.next(s2, ch));
                 if (!vis(next1, next2) && _dfsEqual(next1, next2, rhs, vis)) {
                     return true;
                 }
@@ -207,11 +1587,11 @@ namespace Automata {
             return false;
         }
 
-        void _dfsRedundancy(const std::string &start, _StateSet &vis) {
+        void _dfsRedundancy(const std::string &start, _StateSet &vis) const {
             vis.insert(start);
 
             for (auto const ch: _charSet) {
-                auto next = _automata[start]._transform[ch];
+                const auto &next = this->next(start, ch);
 
                 if (next == "") {
                     continue;
@@ -225,14 +1605,14 @@ namespace Automata {
 
         // 最小化时为了给状态集中的每一种转移状态分组 计算每一种情况的hash
         // 公式是 hash = pos1 & transState1 ^ pos2 & transState2 ^ ...
-        size_t _hash(const std::string &state, std::unordered_map<std::string, int> &map) {
-            auto transform = _automata[state]._transform;
+        size_t _hash(const std::string &state, const std::unordered_map<std::string, int> &map) const {
+            const auto &transform = _automata.at(state)._transform;
             size_t res = 0;
             int index = 0;
 
             for (const auto ch: _charSet) {
                 // 转移到的状态 在重新映射后的分组号
-                auto groupId = map[transform[ch]];
+                auto groupId = map.at(transform[ch]);
                 auto thisHash = std::hash<std::string>{}("trans" + std::to_string(index++))
                     & std::hash<std::string>{}(std::to_string(groupId));
                 res = (res == 0) ? thisHash : res ^ thisHash;
@@ -253,8 +1633,7 @@ namespace Automata {
                 }
 
                 for (const auto ch: _charSet) {
-                    auto next = _automata[sname]._transform[ch];
-                    if (next == "") {
+                    if (sstate._transform[ch] == "") {
                         continue;
                     }
 
@@ -276,25 +1655,58 @@ namespace Automata {
             return _automata.end();
         }
 
+        std::unordered_map<std::string, _State>::const_iterator begin() const {
+            return _automata.begin();
+        }
+
+        std::unordered_map<std::string, _State>::const_iterator end() const {
+            return _automata.end();
+        }
+
+        // 以下查询都是只读的 不会插入状态也不会分配内存
+        // 因此同一个DFA可以在多个线程间无锁共享读取
+
+        const std::string &start() const { return _start; }
+
+        bool contains(const std::string &state) const {
+            return _automata.find(state) != _automata.end();
+        }
+
+        // 不存在的状态视为非终态
+        bool isEnd(const std::string &state) const {
+            auto it = _automata.find(state);
+            return it != _automata.end() && it->second._isEnd;
+        }
+
+        // 状态state接受字符ch后到达的状态 没有转移时返回孤岛状态""
+        const std::string &next(const std::string &state, char ch) const {
+            auto it = _automata.find(state);
+            if (it == _automata.end() || ch < 0
+                || static_cast<std::size_t>(ch) >= it->second._transform.size()) {
+                return _island();
+            }
+            return it->second._transform[ch];
+        }
+
+        // 从开始状态读入input 判断是否被接受
+        bool accept(std::string_view input) const {
+            const auto *state = &_start;
+            for (const auto ch: input) {
+                if (state = &next(*state, ch); state->empty()) {
+                    return false;
+                }
+            }
+            return isEnd(*state);
+        }
+
         /*
          * 两个DFA的等价性判断
          * 参考了 https://www.cnblogs.com/lfri/p/11425266.html 的原理以及实现
          * 简单来说就是 一个DFA取补集 若该补集和另一个DFA不相交 <=> 等价
          */
-        bool operator==(DFA rhs) {
+        bool operator==(const DFA &rhs) const {
             auto vis = _Visit();
-
-            // 初始化vis
-            for (const auto &state1: _automata) {
-                for (const auto &state2: rhs) {
-                    vis(state1.first, state2.first) = false;
-                    vis("", state2.first) = false;
-                }
-                vis(state1.first, "") = false;
-            }
-            vis("", "") = false;
-
-            return !_dfsEqual(_start, rhs._start, rhs, vis);
+            return !_dfsEqual(_key(_start), rhs._key(rhs._start), rhs, vis);
         }
 
         // 去除不可达状态
@@ -328,10 +1740,12 @@ namespace Automata {
          * 3. 满足下面条件时跳出循环：
          *    链表中所有节点都不可再分
          * 4. 根据重新映射构建最小的DFA
+         * 不修改*this 不可达状态直接跳过 而不是先调用removeRedundancy()删除
          */
-        DFA minimize() {
-            // 先去除不可达状态
-            removeRedundancy();
+        DFA minimize() const {
+            // 可达状态
+            auto reachable = _StateSet();
+            _dfsRedundancy(_start, reachable);
 
             // 链表q
             auto q = std::list<_StateSet>();
@@ -339,7 +1753,7 @@ namespace Automata {
             // 映射map: 原先的状态名 → 重新分组后的编号
             auto state2Group = std::unordered_map<std::string, int>();
             // 最大组号
-            auto maxGroup = 1;
+            auto maxGroup = 0;
             // 孤岛状态即不可接受状态 编号0
             state2Group[""] = 0;
             // 根据集合中的每个状态的转移进行分组
@@ -347,29 +1761,30 @@ namespace Automata {
             auto hashGroup = std::unordered_map<std::size_t, _StateSet>();
 
             // 根据终点和非终点划分
-            auto ends = _StateSet();
-            auto endsComp = _StateSet();
+            // 多模式DFA中接受不同模式集合的终态也要分开
+            auto label2Group = std::map<std::pair<bool, std::set<int> >, int>();
+            auto groups = std::vector<_StateSet>();
             for (const auto &[ sname, sstate ]: _automata) {
-                if (sname == "") {
+                if (sname == "" || reachable.find(sname) == reachable.end()) {
                     continue;
                 }
 
-                state2Group[sname] = sstate._isEnd ? 1 : 2;
-                if (sstate._isEnd) {
-                    ends.insert(sname);
-                } else {
-                    endsComp.insert(sname);
-                    maxGroup = 2;
+                auto label = std::make_pair(sstate._isEnd, sstate._patterns);
+                if (label2Group.find(label) == label2Group.end()) {
+                    groups.emplace_back();
+                    label2Group[label] = ++maxGroup;
                 }
+                state2Group[sname] = label2Group[label];
+                groups[label2Group[label] - 1].insert(sname);
             }
-            if (q.push_back(ends); maxGroup == 2) {
-                q.push_back(endsComp);
+            for (auto &group: groups) {
+                q.push_back(std::move(group));
             }
 
             do {
                 for (auto it = q.cbegin(); it != q.cend(); ++it) {
                     hashGroup.clear();
-                    auto s = *it;
+                    const auto &s = *it;
 
                     // 根据hash分组
                     for (const auto &state: s) {
@@ -390,14 +1805,12 @@ namespace Automata {
 
                 if (hashGroup.size() > 1) {
                     auto it = hashGroup.begin();
-                    for (q.push_back(it->second), ++it; it != hashGroup.end(); ++it) {
+                    for (q.push_back(std::move(it->second)), ++it; it != hashGroup.end(); ++it) {
                         ++maxGroup;
-                        auto ss = it->second;
-
-                        q.push_back(ss);
-                        for (const auto &state: ss) {
+                        for (const auto &state: it->second) {
                             state2Group[state] = maxGroup;
                         }
+                        q.push_back(std::move(it->second));
                     }
                 }
             } while (hashGroup.size() != 1);
@@ -411,32 +1824,97 @@ namespace Automata {
                 }
 
                 // 为了从"s0"开始命名 因此要-1
-                auto newState = "s" + std::to_string(gid - 1);
-                res._automata[newState]._isEnd = _automata[gname]._isEnd;
+                const auto &gstate = _automata.at(gname);
+                auto &newState = res._automata["s" + std::to_string(gid - 1)];
+                newState._isEnd = gstate._isEnd;
+                newState._patterns = gstate._patterns;
                 for (const auto ch: _charSet) {
-                    auto next = _automata[gname]._transform[ch];
+                    const auto &next = gstate._transform[ch];
                     if (next == "") {
                         continue;
                     }
 
-                    res._automata[newState]._transform[ch]
-                        = "s" + std::to_string(state2Group[next] - 1);
+                    newState._transform[ch] = "s" + std::to_string(state2Group.at(next) - 1);
                 }
             }
             // 加入孤岛状态
             res._automata[""] = _State();
 
             // 设置DFA的其他属性
-            res._start = "s" + std::to_string(state2Group[_start] - 1);
+            res._start = "s" + std::to_string(state2Group.at(_start) - 1);
             res._charSet = _charSet;
             res._restoreFromTransform();
 
             return res;
         }
+
+        // 编译并冻结成不可变的共享对象 可以直接交给SharedMatcher发布
+        std::shared_ptr<const Matcher> freeze() const {
+            return std::make_shared<const Matcher>(compile());
+        }
+
+        /*
+         * 编译成稠密转移表
+         * 1. 孤岛状态""编号为0 其余状态依次编号
+         * 2. 转移表中列完全相同的字节合并成同一个等价类
+         */
+        Matcher compile() const {
+            auto res = Matcher();
+            auto id = std::unordered_map<std::string, Matcher::State>();
+            auto names = std::vector<const _State *>({ nullptr });
+
+            id[""] = Matcher::DEAD;
+            for (const auto &[ sname, sstate ]: _automata) {
+                if (sname == "") {
+                    continue;
+                }
+                id[sname] = static_cast<Matcher::State>(names.size());
+                names.push_back(&sstate);
+            }
+            res._stateNum = static_cast<int>(names.size());
+            res._start = id.at(_start);
+
+            // 每个字节对应的一列转移 列相同则属于同一等价类
+            auto column2Class = std::map<std::vector<Matcher::State>, int>();
+            auto columns = std::vector<std::vector<Matcher::State> >();
+            for (int ch = 0; ch < 256; ++ch) {
+                auto column = std::vector<Matcher::State>(res._stateNum, Matcher::DEAD);
+                if (ch < 127 && _charSet.count(static_cast<char>(ch))) {
+                    for (int s = 1; s < res._stateNum; ++s) {
+                        column[s] = id.at(names[s]->_transform[ch]);
+                    }
+                }
+
+                auto [ it, inserted ] = column2Class.try_emplace(
+                    column, static_cast<int>(columns.size()));
+                if (inserted) {
+                    columns.push_back(column);
+                }
+                res._classes[ch] = static_cast<unsigned char>(it->second);
+            }
+            res._classNum = static_cast<int>(columns.size());
+
+            res._table.assign(res._stateNum * res._classNum, Matcher::DEAD);
+            res._accept.assign(res._stateNum, false);
+            for (int s = 0; s < res._stateNum; ++s) {
+                for (int c = 0; c < res._classNum; ++c) {
+                    res._table[s * res._classNum + c] = columns[c][s];
+                }
+                res._accept[s] = (s != Matcher::DEAD) && names[s]->_isEnd;
+            }
+            res._patterns.assign(res._stateNum, std::vector<int>());
+            for (int s = 1; s < res._stateNum; ++s) {
+                res._patterns[s].assign(names[s]->_patterns.begin(), names[s]->_patterns.end());
+            }
+            res._prepare();
+
+            return res;
+        }
     };
 
     class NFA {
         using _ll = long long;
+        friend class Regex;
         // 用于确定化的闭包数据结构
         using _Closure = std::set<std::string>;
 
@@ -476,7 +1954,7 @@ namespace Automata {
             return in;
         }
 
-        friend std::ostream& operator<<(std::ostream& out, NFA &rhs) {
+        friend std::ostream& operator<<(std::ostream& out, const NFA &rhs) {
             out << rhs._stateNum << " " << rhs._endNum
                 << " " << rhs._transNum << std::endl;
 
@@ -507,8 +1985,7 @@ namespace Automata {
                     continue;
                 }
 
-                auto t = fromSstate._transform[0];
-                if (t.size() > 1) {
+                if (const auto &t = fromSstate._transform[0]; t.size() > 1) {
                     for (const auto &toState: t) {
                         if (toState == "") {
                             continue;
@@ -518,8 +1995,7 @@ namespace Automata {
                 }
 
                 for (const auto ch: rhs._charSet) {
-                    t = fromSstate._transform[ch];
-                    if (t.size() > 1) {
+                    if (const auto &t = fromSstate._transform[ch]; t.size() > 1) {
                         for (const auto &toState: t) {
                             if (toState == "") {
                                 continue;
@@ -539,6 +2015,8 @@ namespace Automata {
         struct _MultiState {
             std::vector<std::unordered_set<std::string> > _transform;
             bool _isEnd;
+            // 多模式NFA中该终态所属的模式编号
+            std::set<int> _patterns;
 
             _MultiState(bool isEnd = false):
                 _transform(std::vector<std::unordered_set<std::string> >(127, { "" })),
@@ -566,11 +2044,11 @@ namespace Automata {
         _ll _endNum;
         _ll _transNum;
 
-        void _dfs(const std::string fromState, _Closure &c,
-            std::unordered_set<std::string> &vis) {
+        void _dfs(const std::string &fromState, _Closure &c,
+            std::unordered_set<std::string> &vis) const {
             vis.insert(fromState);
 
-            if (auto t = _automata[fromState]._transform[0]; t.size() > 1) {
+            if (const auto &t = _automata.at(fromState)._transform[0]; t.size() > 1) {
                 for (const auto &toState: t) {
                     if (toState == "") {
                         continue;
@@ -585,7 +2063,7 @@ namespace Automata {
         }
 
         // 求ε-闭包: DFS
-        _Closure _closure(const _Closure &c) {
+        _Closure _closure(const _Closure &c) const {
             auto vis = std::unordered_set<std::string>();
             auto res = _Closure();
 
@@ -600,11 +2078,11 @@ namespace Automata {
         }
 
         // 求闭包c接受字符ch后的ε-闭包
-        _Closure _move(const _Closure &c, int ch) {
+        _Closure _move(const _Closure &c, int ch) const {
             auto res = _Closure();
 
             for (const auto &fromState: c) {
-                if (auto next = _automata[fromState]._transform[ch]; next.size() > 1) {
+                if (const auto &next = _automata.at(fromState)._transform[ch]; next.size() > 1) {
                     for (const auto &toState: next) {
                         if (toState == "") {
                             continue;
@@ -619,9 +2097,9 @@ namespace Automata {
         }
 
         // 判断闭包c中是否还有终态
-        bool _isEnd(const _Closure &c) {
+        bool _isEnd(const _Closure &c) const {
             for (const auto &state: c) {
-                if (_automata[state]._isEnd) {
+                if (_automata.at(state)._isEnd) {
                     return true;
                 }
             }
@@ -629,6 +2107,16 @@ namespace Automata {
             return false;
         }
 
+        // 闭包c中所有终态所属的模式编号
+        std::set<int> _patterns(const _Closure &c) const {
+            auto res = std::set<int>();
+            for (const auto &state: c) {
+                const auto &patterns = _automata.at(state)._patterns;
+                res.insert(patterns.begin(), patterns.end());
+            }
+            return res;
+        }
+
     public:
         NFA() = default;
         ~NFA() { }
@@ -642,6 +2130,14 @@ namespace Automata {
             return _automata.end();
         }
 
+        std::unordered_map<std::string, _MultiState>::const_iterator begin() const {
+            return _automata.begin();
+        }
+
+        std::unordered_map<std::string, _MultiState>::const_iterator end() const {
+            return _automata.end();
+        }
+
         /* NFA确定化: 模拟子集法
          * 1. 将开始状态的ε-闭包加入队列q
          * 2. 不断循环 每次取出队首闭包
@@ -651,7 +2147,7 @@ namespace Automata {
          *    其中开始状态的闭包作为DFA的开始状态 带有终态的闭包作为DFA的终态
          *    闭包之间的转移作为DFA的转移
          */
-        DFA determine() {
+        DFA determine() const {
             auto res = DFA();
             res._start = "s0";
             res._automata[""] = DFA::_State(false);
@@ -674,14 +2170,16 @@ namespace Automata {
             res._stateNum++;
 
             while (!q.empty()) {
-                auto c = q.front(); q.pop();
+                auto c = std::move(q.front()); q.pop();
+                auto &state = res._automata["s" + std::to_string(map[c])];
 
                 // 带有终态的闭包 作为映射后 DFA的终态
                 if (_isEnd(c)) {
-                    res._automata["s" + std::to_string(map[c])]._isEnd = true;
+                    state._isEnd = true;
+                    state._patterns = _patterns(c);
                     res._endNum++;
                 } else {
-                    res._automata["s" + std::to_string(map[c])]._isEnd = false;
+                    state._isEnd = false;
                 }
 
                 for (const auto ch: _charSet) {
@@ -695,13 +2193,12 @@ namespace Automata {
                         }
 
                         // 闭包间的转移 作为映射后 DFA状态的转移
-                        res._automata["s" + std::to_string(map[c])]._transform[ch]
-                            = "s" + std::to_string(map[move_c]);
+                        state._transform[ch] = "s" + std::to_string(map[move_c]);
                         res._transNum++;
 
                         if (vis.find(move_c) == vis.end()) {
                             vis.insert(move_c);
-                            q.push(move_c);
+                            q.push(std::move(move_c));
                         }
                     }
                 }
@@ -711,9 +2208,170 @@ namespace Automata {
         }
 
         // 一步到位 先确定化再最小化
-        DFA toMinimizedDFA() {
+        DFA toMinimizedDFA() const {
             return determine().minimize();
         }
+
+        /*
+         * 多模式合并: 新建开始状态 用ε转移连到每个模式NFA的开始状态
+         * 第i个模式的状态重命名为"p{i}_状态名" 其终态标记上模式编号i
+         * 确定化后每个终态携带其闭包中所有模式的编号 最小化时只合并模式集合相同的终态
+         */
+        static NFA unite(const std::vector<NFA> &patterns) {
+            auto res = NFA();
+            res._start = "start";
+            res._automata[""] = _MultiState();
+            res._automata[res._start] = _MultiState();
+            res._stateNum = 1;
+            res._endNum = 0;
+            res._transNum = 0;
+
+            for (int i = 0; i < static_cast<int>(patterns.size()); ++i) {
+                const auto &pattern = patterns[i];
+                auto prefix = "p" + std::to_string(i) + "_";
+                auto rename = [&prefix](const std::string &name) {
+                    return name == "" ? name : prefix + name;
+                };
+
+                for (const auto &[ sname, sstate ]: pattern._automata) {
+                    if (sname == "") {
+                        continue;
+                    }
+
+                    auto &state = res._automata[rename(sname)];
+                    ++res._stateNum;
+                    if (state._isEnd = sstate._isEnd; state._isEnd) {
+                        state._patterns.insert(i);
+                        ++res._endNum;
+                    }
+
+                    for (std::size_t ch = 0; ch < sstate._transform.size(); ++ch) {
+                        for (const auto &toState: sstate._transform[ch]) {
+                            if (toState == "") {
+                                continue;
+                            }
+                            state._transform[ch].insert(rename(toState));
+                            ++res._transNum;
+                        }
+                    }
+                }
+
+                res._automata[res._start]._transform[0].insert(rename(pattern._start));
+                ++res._transNum;
+                res._charSet.insert(pattern._charSet.begin(), pattern._charSet.end());
+            }
+
+            return res;
+        }
+    };
+
+    /*
+     * Aho–Corasick关键字自动机
+     * 只含字面量的模式集合不需要走子集法 直接建trie并求失败指针
+     * 失败指针在建表时就展开成完整的转移 编译结果与DFA::compile()的Matcher格式相同
+     * 建表时间与 关键字总长 × 字节等价类数 成正比
+     */
+    class AhoCorasick {
+    private:
+        std::vector<std::string> _keywords;
+
+    public:
+        AhoCorasick() = default;
+        AhoCorasick(const std::vector<std::string> &keywords): _keywords(keywords) { }
+        ~AhoCorasick() { }
+
+        // 加入一个关键字 返回其模式编号
+        int insert(std::string keyword) {
+            _keywords.push_back(std::move(keyword));
+            return static_cast<int>(_keywords.size()) - 1;
+        }
+
+        /*
+         * 1. 关键字中出现的每个字节各成一类 其余字节归入同一类
+         * 2. 建trie: 状态0是死状态(不可达) 状态1是根 缺失的边暂时指向死状态
+         * 3. 按BFS序求失败指针 缺失的边补成失败状态的对应转移
+         *    每个状态的模式编号 = 自身结束的关键字 ∪ 失败状态的模式编号
+         */
+        Matcher compile() const {
+            auto res = Matcher();
+
+            auto used = std::array<bool, 256>();
+            for (const auto &keyword: _keywords) {
+                for (const auto ch: keyword) {
+                    used[static_cast<unsigned char>(ch)] = true;
+                }
+            }
+            // 类0: 关键字中没有出现过的字节
+            res._classNum = 1;
+            for (int ch = 0; ch < 256; ++ch) {
+                res._classes[ch] = used[ch] ? static_cast<unsigned char>(res._classNum++) : 0;
+            }
+
+            const auto root = 1;
+            const auto classNum = res._classNum;
+            res._start = root;
+            res._table.assign(2 * classNum, Matcher::DEAD);
+            res._patterns.assign(2, std::vector<int>());
+
+            for (int id = 0; id < static_cast<int>(_keywords.size()); ++id) {
+                auto s = root;
+                for (const auto ch: _keywords[id]) {
+                    auto c = res._classes[static_cast<unsigned char>(ch)];
+                    if (res._table[s * classNum + c] == Matcher::DEAD) {
+                        res._table[s * classNum + c] = static_cast<Matcher::State>(res._patterns.size());
+                        res._table.resize(res._table.size() + classNum, Matcher::DEAD);
+                        res._patterns.emplace_back();
+                    }
+                    s = res._table[s * classNum + c];
+                }
+                res._patterns[s].push_back(id);
+            }
+            res._stateNum = static_cast<int>(res._patterns.size());
+
+            // 将fallback的模式编号并入s fallback比s浅 在BFS序中已经处理完毕
+            auto inherit = [&res](Matcher::State s, Matcher::State fallback) {
+                auto merged = std::vector<int>();
+                std::set_union(res._patterns[s].begin(), res._patterns[s].end(),
+                    res._patterns[fallback].begin(), res._patterns[fallback].end(),
+                    std::back_inserter(merged));
+                res._patterns[s].swap(merged);
+            };
+
+            auto fail = std::vector<Matcher::State>(res._stateNum, root);
+            auto q = std::queue<Matcher::State>();
+            for (int c = 0; c < classNum; ++c) {
+                if (auto &next = res._table[root * classNum + c]; next == Matcher::DEAD) {
+                    next = root;
+                } else {
+                    inherit(next, root);
+                    q.push(next);
+                }
+            }
+
+            while (!q.empty()) {
+                auto s = q.front(); q.pop();
+                for (int c = 0; c < classNum; ++c) {
+                    auto &next = res._table[s * classNum + c];
+                    auto fallback = res._table[fail[s] * classNum + c];
+                    if (next == Matcher::DEAD) {
+                        next = fallback;
+                        continue;
+                    }
+
+                    fail[next] = fallback;
+                    inherit(next, fallback);
+                    q.push(next);
+                }
+            }
+
+            res._accept.assign(res._stateNum, false);
+            for (int s = 0; s < res._stateNum; ++s) {
+                res._accept[s] = !res._patterns[s].empty();
+            }
+            res._prepare();
+
+            return res;
+        }
     };
 }
 
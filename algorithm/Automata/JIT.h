@@ -0,0 +1,279 @@
+/*
+ * JIT.h
+ * Implemention of x86-64 JIT for compiled DFA.
+ * Copyright (c) zx5. All rights reserved.
+ */
+
+#ifndef __COMPILER_AUTOMATA_JIT_
+#define __COMPILER_AUTOMATA_JIT_
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "Automata.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define __COMPILER_AUTOMATA_JIT_X86_64_
+#endif
+
+namespace Automata {
+    /*
+     * 把Matcher翻译成x86-64机器码 放在mmap出来的可执行页中
+     * 每个状态是一段代码 读入一个字节后通过比较跳转链或跳转表直接跳到下一个状态的代码
+     * 不需要运行时的C++工具链 也没有解释循环中查转移表的load
+     * 不支持的平台或mmap失败时退回到Matcher的查表执行
+     *
+     * 生成的函数: int f(const char *p, const char *end, int state)
+     *   rdi = p, rsi = end, edx = 开始状态, 返回值eax = 最终状态
+     *   rcx = 字节等价类表, r8/rdx 用于间接跳转
+     * 内存布局: [入口][死状态出口][各状态代码][对齐][等价类表][各状态跳转表][入口表]
+     */
+    class JITMatcher {
+    public:
+        using State = Matcher::State;
+
+    private:
+        using _Function = int (*)(const char *, const char *, int);
+
+        // 活转移的目标状态不超过该数时使用比较跳转链 否则使用跳转表
+        static constexpr int _CHAIN_MAX_TARGETS = 4;
+
+        Matcher _matcher;
+        void *_code = nullptr;
+        std::size_t _size = 0;
+        _Function _entry = nullptr;
+
+        // 机器码缓冲区 记录需要回填的rel32和绝对地址
+        class _Assembler {
+        public:
+            std::vector<unsigned char> _buf;
+            // (rel32所在位置, 目标标签)
+            std::vector<std::pair<std::size_t, int> > _rel;
+            // (8字节绝对地址所在位置, 目标标签)
+            std::vector<std::pair<std::size_t, int> > _abs;
+            std::vector<std::size_t> _labels;
+
+            int label() {
+                _labels.push_back(0);
+                return static_cast<int>(_labels.size()) - 1;
+            }
+
+            void bind(int l) { _labels[l] = _buf.size(); }
+
+            void byte(std::initializer_list<unsigned char> bytes) {
+                _buf.insert(_buf.end(), bytes.begin(), bytes.end());
+            }
+
+            void imm32(std::uint32_t v) {
+                for (int i = 0; i < 4; ++i) {
+                    _buf.push_back(static_cast<unsigned char>(v >> (8 * i)));
+                }
+            }
+
+            void rel32(int l) {
+                _rel.emplace_back(_buf.size(), l);
+                imm32(0);
+            }
+
+            void abs64(int l) {
+                _abs.emplace_back(_buf.size(), l);
+                _buf.insert(_buf.end(), 8, 0);
+            }
+
+            void align(std::size_t n) {
+                while (_buf.size() % n) {
+                    _buf.push_back(0xCC);
+                }
+            }
+
+            // 回填 base是代码最终所在的地址
+            void link(unsigned char *base) {
+                for (const auto &[ pos, l ]: _rel) {
+                    auto v = static_cast<std::int32_t>(
+                        static_cast<std::int64_t>(_labels[l]) - static_cast<std::int64_t>(pos + 4));
+                    std::memcpy(&_buf[pos], &v, 4);
+                }
+                for (const auto &[ pos, l ]: _abs) {
+                    auto v = reinterpret_cast<std::uint64_t>(base + _labels[l]);
+                    std::memcpy(&_buf[pos], &v, 8);
+                }
+            }
+        };
+
+        // 生成机器码 返回false表示放弃编译
+        bool _compile() {
+#ifdef __COMPILER_AUTOMATA_JIT_X86_64_
+            const auto &m = _matcher;
+            auto a = _Assembler();
+            auto classes = a.label(), entries = a.label(), deadExit = a.label();
+            auto blocks = std::vector<int>(m._stateNum), exits = std::vector<int>(m._stateNum);
+            auto tables = std::vector<int>(m._stateNum, -1);
+            for (State s = 0; s < m._stateNum; ++s) {
+                blocks[s] = a.label();
+                exits[s] = a.label();
+            }
+
+            // 入口: lea rcx, [rip + classes]; lea r8, [rip + entries]
+            //       mov edx, edx (高32位清零); jmp [r8 + rdx * 8]
+            a.byte({ 0x48, 0x8D, 0x0D }); a.rel32(classes);
+            a.byte({ 0x4C, 0x8D, 0x05 }); a.rel32(entries);
+            a.byte({ 0x89, 0xD2 });
+            a.byte({ 0x41, 0xFF, 0x24, 0xD0 });
+
+            // 死状态不会再离开 直接返回: xor eax, eax; ret
+            a.bind(deadExit);
+            a.byte({ 0x31, 0xC0, 0xC3 });
+            a.bind(blocks[Matcher::DEAD]);
+            a.bind(exits[Matcher::DEAD]);
+            a.byte({ 0x31, 0xC0, 0xC3 });
+
+            for (State s = 1; s < m._stateNum; ++s) {
+                a.bind(blocks[s]);
+                // cmp rdi, rsi; jae exit
+                a.byte({ 0x48, 0x39, 0xF7 });
+                a.byte({ 0x0F, 0x83 }); a.rel32(exits[s]);
+                // movzx eax, byte [rdi]; movzx eax, byte [rcx + rax]; inc rdi
+                a.byte({ 0x0F, 0xB6, 0x07 });
+                a.byte({ 0x0F, 0xB6, 0x04, 0x01 });
+                a.byte({ 0x48, 0xFF, 0xC7 });
+
+                // 按目标状态把活转移的等价类分组
+                auto targets = std::vector<std::pair<State, std::vector<int> > >();
+                for (int c = 0; c < m._classNum; ++c) {
+                    auto t = m._table[s * m._classNum + c];
+                    if (t == Matcher::DEAD) {
+                        continue;
+                    }
+                    auto it = std::find_if(targets.begin(), targets.end(),
+                        [t](const auto &p) { return p.first == t; });
+                    if (it == targets.end()) {
+                        targets.push_back({ t, { c } });
+                    } else {
+                        it->second.push_back(c);
+                    }
+                }
+
+                auto compares = std::size_t(0);
+                for (const auto &target: targets) {
+                    compares += target.second.size();
+                }
+                if (static_cast<int>(targets.size()) <= _CHAIN_MAX_TARGETS
+                    && compares <= 2 * _CHAIN_MAX_TARGETS) {
+                    // cmp eax, imm32; je block
+                    for (const auto &[ t, cs ]: targets) {
+                        for (const auto c: cs) {
+                            a.byte({ 0x3D }); a.imm32(static_cast<std::uint32_t>(c));
+                            a.byte({ 0x0F, 0x84 }); a.rel32(blocks[t]);
+                        }
+                    }
+                    // jmp deadExit
+                    a.byte({ 0xE9 }); a.rel32(deadExit);
+                } else {
+                    // lea rdx, [rip + table]; jmp [rdx + rax * 8]
+                    tables[s] = a.label();
+                    a.byte({ 0x48, 0x8D, 0x15 }); a.rel32(tables[s]);
+                    a.byte({ 0xFF, 0x24, 0xC2 });
+                }
+
+                // mov eax, s; ret
+                a.bind(exits[s]);
+                a.byte({ 0xB8 }); a.imm32(static_cast<std::uint32_t>(s));
+                a.byte({ 0xC3 });
+            }
+
+            a.align(8);
+            a.bind(classes);
+            a._buf.insert(a._buf.end(), m._classes.begin(), m._classes.end());
+            a.align(8);
+            for (State s = 1; s < m._stateNum; ++s) {
+                if (tables[s] == -1) {
+                    continue;
+                }
+                a.bind(tables[s]);
+                for (int c = 0; c < m._classNum; ++c) {
+                    auto t = m._table[s * m._classNum + c];
+                    a.abs64(t == Matcher::DEAD ? deadExit : blocks[t]);
+                }
+            }
+            a.bind(entries);
+            for (State s = 0; s < m._stateNum; ++s) {
+                a.abs64(blocks[s]);
+            }
+
+            _size = a._buf.size();
+            _code = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (_code == MAP_FAILED) {
+                _code = nullptr;
+                return false;
+            }
+            a.link(static_cast<unsigned char *>(_code));
+            std::memcpy(_code, a._buf.data(), _size);
+            if (mprotect(_code, _size, PROT_READ | PROT_EXEC) != 0) {
+                _release();
+                return false;
+            }
+
+            _entry = reinterpret_cast<_Function>(_code);
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        void _release() {
+#ifdef __COMPILER_AUTOMATA_JIT_X86_64_
+            if (_code != nullptr) {
+                munmap(_code, _size);
+            }
+#endif
+            _code = nullptr;
+            _size = 0;
+            _entry = nullptr;
+        }
+
+    public:
+        JITMatcher(Matcher matcher): _matcher(std::move(matcher)) {
+            _compile();
+        }
+        ~JITMatcher() { _release(); }
+
+        JITMatcher(const JITMatcher &) = delete;
+        JITMatcher &operator=(const JITMatcher &) = delete;
+
+        JITMatcher(JITMatcher &&rhs) noexcept:
+            _matcher(std::move(rhs._matcher)), _code(rhs._code), _size(rhs._size), _entry(rhs._entry) {
+            rhs._code = nullptr;
+            rhs._size = 0;
+            rhs._entry = nullptr;
+        }
+
+        // 是否成功生成了机器码 否则run()使用查表执行
+        bool available() const { return _entry != nullptr; }
+
+        // 生成的机器码字节数
+        std::size_t codeSize() const { return _size; }
+
+        const Matcher &matcher() const { return _matcher; }
+
+        State start() const { return _matcher.start(); }
+
+        bool isAccept(State s) const { return _matcher.isAccept(s); }
+
+        State run(State s, std::string_view input) const {
+            if (!available()) {
+                return _matcher.run(s, input);
+            }
+            return _entry(input.data(), input.data() + input.size(), s);
+        }
+
+        bool match(std::string_view input) const {
+            return isAccept(run(start(), input));
+        }
+    };
+}
+
+#endif
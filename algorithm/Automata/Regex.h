@@ -0,0 +1,632 @@
+/*
+ * Regex.h
+ * Implemention of regular expression front end of Automata.
+ * Copyright (c) zx5. All rights reserved.
+ */
+
+#ifndef __COMPILER_AUTOMATA_REGEX_
+#define __COMPILER_AUTOMATA_REGEX_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <set>
+#include <map>
+#include <tuple>
+#include <queue>
+#include <bitset>
+#include <algorithm>
+#include <unordered_map>
+#include <stdexcept>
+#include "Automata.h"
+
+namespace Automata {
+    /*
+     * 正则表达式
+     * 文法:
+     *   <regex>  ::= <concat> { '|' <concat> }
+     *   <concat> ::= { <repeat> }
+     *   <repeat> ::= <atom> { '*' | '+' | '?' }
+     *   <atom>   ::= '(' <regex> ')' | '[' ['^'] <class> ']' | '.' | '\' <char> | <char>
+     * 字符集和自动机一致 为ascii值b满足32<=b<=126的字符
+     * 语法错误时构造函数抛出std::invalid_argument
+     * toNFA()用Glushkov构造 toDFA()用Brzozowski导数构造DFA后再调用DFA::minimize()
+     */
+    class Regex {
+    public:
+        // 可以出现在正则中的最小/最大字符
+        static constexpr int MIN_CHAR = 32;
+        static constexpr int MAX_CHAR = 126;
+
+    private:
+        enum class _Type {
+            EPSILON,
+            SYMBOL,
+            CONCAT,
+            UNION,
+            STAR,
+            PLUS,
+            OPTIONAL,
+        };
+
+        // 语法树结点 子结点以下标的形式存放在_nodes中
+        struct _Node {
+            _Type _type;
+            // SYMBOL: 该位置可以接受的字符
+            std::vector<char> _chars;
+            int _lhs;
+            int _rhs;
+
+            _Node(_Type type, int lhs = -1, int rhs = -1):
+                _type(type), _lhs(lhs), _rhs(rhs) { }
+            ~_Node() { }
+        };
+
+        // Glushkov构造中每个子表达式的信息
+        struct _Glushkov {
+            bool _nullable;
+            std::vector<int> _first;
+            std::vector<int> _last;
+        };
+
+        /*
+         * Brzozowski导数用到的项 所有项都经过hash-consing
+         * 结构相同的项只有一个编号 因此判断两个项是否相同只需比较编号
+         * 构造时按相似性规则规范化:
+         *   r|r = r  r|s = s|r  (r|s)|t = r|(s|t)  ∅|r = r
+         *   ∅r = r∅ = ∅  εr = rε = r  (rs)t = r(st)
+         *   (r*)* = r*  ε* = ∅* = ε
+         *   [a]|[b] = [ab]  r|ε = r (r可以为空时)
+         *   (ε|r)* = (r?)* = r*  (r*|s)* = (r|s)*
+         * 规范化只保证导数的种类有限 不能判定所有等价的项
+         * 例如a*a*和a*不相似 由导数得到的DFA不一定最小
+         */
+        class _Terms {
+        public:
+            enum class Kind {
+                EMPTY,
+                EPSILON,
+                SET,
+                CONCAT,
+                STAR,
+                OR,
+            };
+
+            static constexpr int EMPTY = 0;
+            static constexpr int EPSILON = 1;
+
+        private:
+            using _Set = std::bitset<MAX_CHAR + 1>;
+
+            struct _Term {
+                Kind _kind;
+                _Set _set;
+                std::vector<int> _children;
+                bool _nullable;
+            };
+
+            std::vector<_Term> _terms;
+            // 项的结构 → 编号
+            std::map<std::tuple<Kind, std::string, std::vector<int> >, int> _id;
+            // (项, 字符类) → 导数
+            std::unordered_map<long long, int> _derivative;
+
+            int _make(Kind kind, const _Set &set, std::vector<int> children, bool nullable) {
+                auto key = std::make_tuple(kind, set.to_string(), children);
+                if (auto it = _id.find(key); it != _id.end()) {
+                    return it->second;
+                }
+
+                _terms.push_back({ kind, set, std::move(children), nullable });
+                return _id[key] = static_cast<int>(_terms.size()) - 1;
+            }
+
+        public:
+            _Terms() {
+                _make(Kind::EMPTY, _Set(), {}, false);
+                _make(Kind::EPSILON, _Set(), {}, true);
+            }
+            ~_Terms() { }
+
+            int size() const { return static_cast<int>(_terms.size()); }
+
+            bool nullable(int t) const { return _terms[t]._nullable; }
+
+            int set(const std::vector<char> &chars) {
+                auto res = _Set();
+                for (const auto ch: chars) {
+                    res.set(ch);
+                }
+                return res.none() ? EMPTY : _make(Kind::SET, res, {}, false);
+            }
+
+            int concat(int a, int b) {
+                if (a == EMPTY || b == EMPTY) {
+                    return EMPTY;
+                }
+                if (a == EPSILON) {
+                    return b;
+                }
+                if (b == EPSILON) {
+                    return a;
+                }
+                if (_terms[a]._kind == Kind::CONCAT) {
+                    auto first = _terms[a]._children[0], second = _terms[a]._children[1];
+                    return concat(first, concat(second, b));
+                }
+                return _make(Kind::CONCAT, _Set(), { a, b }, nullable(a) && nullable(b));
+            }
+
+            int star(int a) {
+                if (a == EMPTY || a == EPSILON) {
+                    return EPSILON;
+                }
+                if (_terms[a]._kind == Kind::STAR) {
+                    return a;
+                }
+                if (_terms[a]._kind == Kind::OR) {
+                    // 星号下的分支中 ε可以去掉 r*可以换成r
+                    auto children = _terms[a]._children;
+                    auto inner = EMPTY;
+                    for (auto child: children) {
+                        if (_terms[child]._kind == Kind::STAR) {
+                            child = _terms[child]._children[0];
+                        }
+                        if (child != EPSILON) {
+                            inner = alter(inner, child);
+                        }
+                    }
+                    if (inner != a) {
+                        return star(inner);
+                    }
+                }
+                return _make(Kind::STAR, _Set(), { a }, true);
+            }
+
+            int alter(int a, int b) {
+                auto children = std::vector<int>();
+                auto nullable = false;
+                for (const auto t: { a, b }) {
+                    if (_terms[t]._kind == Kind::OR) {
+                        children.insert(children.end(),
+                            _terms[t]._children.begin(), _terms[t]._children.end());
+                    } else if (t != EMPTY) {
+                        children.push_back(t);
+                    }
+                    nullable = nullable || this->nullable(t);
+                }
+
+                // 所有字符集合并成一个
+                auto merged = _Set();
+                auto sets = 0;
+                auto absorb = false;
+                for (const auto t: children) {
+                    if (_terms[t]._kind == Kind::SET) {
+                        merged |= _terms[t]._set;
+                        ++sets;
+                    }
+                    absorb = absorb || (t != EPSILON && this->nullable(t));
+                }
+                if (sets > 1) {
+                    children.erase(std::remove_if(children.begin(), children.end(),
+                        [this](int t) { return _terms[t]._kind == Kind::SET; }), children.end());
+                    children.push_back(_make(Kind::SET, merged, {}, false));
+                }
+                // 已有可以为空的分支时 ε是多余的
+                if (absorb) {
+                    children.erase(std::remove(children.begin(), children.end(), EPSILON), children.end());
+                }
+
+                std::sort(children.begin(), children.end());
+                children.erase(std::unique(children.begin(), children.end()), children.end());
+                if (children.empty()) {
+                    return EMPTY;
+                }
+                if (children.size() == 1) {
+                    return children.front();
+                }
+                return _make(Kind::OR, _Set(), std::move(children), nullable);
+            }
+
+            /*
+             * 项t对字符ch的导数 结果按(t, cls)记忆化
+             * cls是ch所在的字符类 同一类中的字符导数相同
+             */
+            int derive(int t, char ch, int cls, int classNum) {
+                auto key = static_cast<long long>(t) * classNum + cls;
+                if (auto it = _derivative.find(key); it != _derivative.end()) {
+                    return it->second;
+                }
+
+                auto res = EMPTY;
+                // 注意_terms可能在递归中扩容 不能持有对其元素的引用
+                switch (_terms[t]._kind) {
+                    case Kind::EMPTY:
+                    case Kind::EPSILON:
+                        break;
+                    case Kind::SET:
+                        res = _terms[t]._set.test(ch) ? EPSILON : EMPTY;
+                        break;
+                    case Kind::CONCAT: {
+                        auto a = _terms[t]._children[0], b = _terms[t]._children[1];
+                        res = concat(derive(a, ch, cls, classNum), b);
+                        if (nullable(a)) {
+                            res = alter(res, derive(b, ch, cls, classNum));
+                        }
+                        break;
+                    }
+                    case Kind::STAR:
+                        res = concat(derive(_terms[t]._children[0], ch, cls, classNum), t);
+                        break;
+                    case Kind::OR: {
+                        auto children = _terms[t]._children;
+                        for (const auto child: children) {
+                            res = alter(res, derive(child, ch, cls, classNum));
+                        }
+                        break;
+                    }
+                }
+
+                return _derivative[key] = res;
+            }
+        };
+
+        std::string _pattern;
+        std::size_t _pos;
+        std::vector<_Node> _nodes;
+        int _root;
+        // 符号出现的位置 → 语法树结点
+        std::vector<int> _positions;
+
+        [[noreturn]] void _error(const std::string &msg) const {
+            throw std::invalid_argument("regex \"" + _pattern + "\" at "
+                + std::to_string(_pos) + ": " + msg);
+        }
+
+        bool _eof() const { return _pos >= _pattern.size(); }
+
+        char _peek() const { return _pattern[_pos]; }
+
+        int _make(_Type type, int lhs = -1, int rhs = -1) {
+            _nodes.emplace_back(type, lhs, rhs);
+            return static_cast<int>(_nodes.size()) - 1;
+        }
+
+        int _symbol(std::vector<char> chars) {
+            auto res = _make(_Type::SYMBOL);
+            _nodes[res]._chars = std::move(chars);
+            _positions.push_back(res);
+            return res;
+        }
+
+        char _char() {
+            if (_eof()) {
+                _error("unexpected end");
+            }
+            auto ch = _pattern[_pos++];
+            if (ch < MIN_CHAR || ch > MAX_CHAR) {
+                _error("character out of range");
+            }
+            return ch;
+        }
+
+        int _parseRegex() {
+            auto res = _parseConcat();
+            while (!_eof() && _peek() == '|') {
+                ++_pos;
+                res = _make(_Type::UNION, res, _parseConcat());
+            }
+            return res;
+        }
+
+        int _parseConcat() {
+            auto res = -1;
+            while (!_eof() && _peek() != '|' && _peek() != ')') {
+                auto rhs = _parseRepeat();
+                res = (res == -1) ? rhs : _make(_Type::CONCAT, res, rhs);
+            }
+            return res == -1 ? _make(_Type::EPSILON) : res;
+        }
+
+        int _parseRepeat() {
+            auto res = _parseAtom();
+            for (; !_eof(); ++_pos) {
+                if (_peek() == '*') {
+                    res = _make(_Type::STAR, res);
+                } else if (_peek() == '+') {
+                    res = _make(_Type::PLUS, res);
+                } else if (_peek() == '?') {
+                    res = _make(_Type::OPTIONAL, res);
+                } else {
+                    break;
+                }
+            }
+            return res;
+        }
+
+        int _parseAtom() {
+            switch (auto ch = _char(); ch) {
+                case '(': {
+                    auto res = _parseRegex();
+                    if (_eof() || _peek() != ')') {
+                        _error("missing ')'");
+                    }
+                    ++_pos;
+                    return res;
+                }
+                case '[':
+                    return _symbol(_parseClass());
+                case '.': {
+                    auto chars = std::vector<char>();
+                    for (int c = MIN_CHAR; c <= MAX_CHAR; ++c) {
+                        chars.push_back(static_cast<char>(c));
+                    }
+                    return _symbol(chars);
+                }
+                case '\\':
+                    return _symbol({ _char() });
+                case '*':
+                case '+':
+                case '?':
+                case ')':
+                    _error(std::string("unexpected '") + ch + "'");
+                default:
+                    return _symbol({ ch });
+            }
+        }
+
+        // 字符类 '['已经读入
+        std::vector<char> _parseClass() {
+            auto in = std::vector<bool>(MAX_CHAR + 1, false);
+            auto negate = !_eof() && _peek() == '^';
+            if (negate) {
+                ++_pos;
+            }
+
+            for (auto first = true; first || _eof() || _peek() != ']'; first = false) {
+                auto lo = _char();
+                if (lo == '\\') {
+                    lo = _char();
+                }
+                auto hi = lo;
+                if (_pos + 1 < _pattern.size() && _peek() == '-' && _pattern[_pos + 1] != ']') {
+                    ++_pos;
+                    if (hi = _char(); hi == '\\') {
+                        hi = _char();
+                    }
+                    if (hi < lo) {
+                        _error("invalid range");
+                    }
+                }
+                for (int c = lo; c <= hi; ++c) {
+                    in[c] = true;
+                }
+            }
+            ++_pos;
+
+            auto res = std::vector<char>();
+            for (int c = MIN_CHAR; c <= MAX_CHAR; ++c) {
+                if (in[c] != negate) {
+                    res.push_back(static_cast<char>(c));
+                }
+            }
+            return res;
+        }
+
+        static std::vector<int> _merge(const std::vector<int> &a, const std::vector<int> &b) {
+            auto res = a;
+            res.insert(res.end(), b.begin(), b.end());
+            return res;
+        }
+
+        // 自底向上计算nullable、first、last 同时填写follow
+        _Glushkov _glushkov(int node, std::vector<std::set<int> > &follow,
+            const std::vector<int> &posOf) const {
+            const auto &n = _nodes[node];
+            switch (n._type) {
+                case _Type::EPSILON:
+                    return { true, {}, {} };
+                case _Type::SYMBOL:
+                    return { false, { posOf[node] }, { posOf[node] } };
+                case _Type::CONCAT: {
+                    auto l = _glushkov(n._lhs, follow, posOf), r = _glushkov(n._rhs, follow, posOf);
+                    for (const auto p: l._last) {
+                        follow[p].insert(r._first.begin(), r._first.end());
+                    }
+                    return { l._nullable && r._nullable,
+                        l._nullable ? _merge(l._first, r._first) : l._first,
+                        r._nullable ? _merge(l._last, r._last) : r._last };
+                }
+                case _Type::UNION: {
+                    auto l = _glushkov(n._lhs, follow, posOf), r = _glushkov(n._rhs, follow, posOf);
+                    return { l._nullable || r._nullable,
+                        _merge(l._first, r._first), _merge(l._last, r._last) };
+                }
+                case _Type::STAR:
+                case _Type::PLUS:
+                case _Type::OPTIONAL: {
+                    auto sub = _glushkov(n._lhs, follow, posOf);
+                    if (n._type != _Type::OPTIONAL) {
+                        for (const auto p: sub._last) {
+                            follow[p].insert(sub._first.begin(), sub._first.end());
+                        }
+                    }
+                    sub._nullable = sub._nullable || n._type != _Type::PLUS;
+                    return sub;
+                }
+            }
+            return { true, {}, {} };
+        }
+
+        // 将语法树结点转换为规范化的项
+        int _toTerm(int node, _Terms &terms) const {
+            const auto &n = _nodes[node];
+            switch (n._type) {
+                case _Type::EPSILON:
+                    return _Terms::EPSILON;
+                case _Type::SYMBOL:
+                    return terms.set(n._chars);
+                case _Type::CONCAT:
+                    return terms.concat(_toTerm(n._lhs, terms), _toTerm(n._rhs, terms));
+                case _Type::UNION:
+                    return terms.alter(_toTerm(n._lhs, terms), _toTerm(n._rhs, terms));
+                case _Type::STAR:
+                    return terms.star(_toTerm(n._lhs, terms));
+                case _Type::PLUS: {
+                    auto sub = _toTerm(n._lhs, terms);
+                    return terms.concat(sub, terms.star(sub));
+                }
+                case _Type::OPTIONAL:
+                    return terms.alter(_toTerm(n._lhs, terms), _Terms::EPSILON);
+            }
+            return _Terms::EMPTY;
+        }
+
+    public:
+        Regex(std::string_view pattern): _pattern(pattern), _pos(0) {
+            _root = _parseRegex();
+            if (!_eof()) {
+                _error("unexpected ')'");
+            }
+        }
+        ~Regex() { }
+
+        // 符号出现的次数
+        int positions() const { return static_cast<int>(_positions.size()); }
+
+        /*
+         * Glushkov(位置)自动机: 不含ε转移 n个符号出现对应n+1个状态
+         * 1. 状态q0是开始状态 第i个符号出现对应状态q{i}
+         * 2. q0 经 first中位置p的字符 → q{p}
+         *    q{i} 经 follow(i)中位置p的字符 → q{p}
+         * 3. last中的位置是终态 表达式可以为空时q0也是终态
+         */
+        NFA toNFA() const {
+            auto n = positions();
+            auto posOf = std::vector<int>(_nodes.size(), 0);
+            for (int i = 0; i < n; ++i) {
+                posOf[_positions[i]] = i + 1;
+            }
+            auto follow = std::vector<std::set<int> >(n + 1);
+            auto info = _glushkov(_root, follow, posOf);
+            follow[0].insert(info._first.begin(), info._first.end());
+
+            auto res = NFA();
+            auto name = [](int i) { return "q" + std::to_string(i); };
+            res._start = name(0);
+            res._automata[""] = NFA::_MultiState();
+            for (int i = 0; i <= n; ++i) {
+                res._automata[name(i)] = NFA::_MultiState();
+            }
+            res._stateNum = n + 1;
+            res._endNum = 0;
+            res._transNum = 0;
+
+            for (const auto p: info._last) {
+                res._automata[name(p)]._isEnd = true;
+            }
+            res._automata[name(0)]._isEnd = info._nullable;
+            for (int i = 0; i <= n; ++i) {
+                res._endNum += res._automata[name(i)]._isEnd;
+            }
+
+            for (int i = 0; i <= n; ++i) {
+                auto &state = res._automata[name(i)];
+                for (const auto p: follow[i]) {
+                    for (const auto ch: _nodes[_positions[p - 1]]._chars) {
+                        state._transform[ch].insert(name(p));
+                        res._charSet.insert(ch);
+                        ++res._transNum;
+                    }
+                }
+            }
+
+            return res;
+        }
+
+        /*
+         * Brzozowski导数直接构造DFA 不经过NFA::determine()
+         * 1. 按正则中出现的字符集合把字符划分成字符类 同一类的字符导数相同
+         * 2. 从正则对应的项开始BFS 每个不同的项是一个状态 对每个字符类求导数得到转移
+         *    可以为空(nullable)的项是终态 ∅对应孤岛状态""
+         * 3. 项经过hash-consing和相似性规范化 每个导数只计算一次
+         * 4. 最后用DFA::minimize()合并规范化没有识别出的等价状态 返回的是最小DFA
+         *    即这里是Brzozowski导数构造加上一次最小化 不是只靠导数得到最小DFA
+         */
+        DFA toDFA() const {
+            // 字符 → 字符类: 按该字符属于哪些符号出现划分
+            auto signature = std::map<std::vector<bool>, int>();
+            auto classOf = std::vector<int>(MAX_CHAR + 1, -1);
+            auto alphabet = std::vector<char>();
+            for (int c = MIN_CHAR; c <= MAX_CHAR; ++c) {
+                auto key = std::vector<bool>(_positions.size(), false);
+                auto used = false;
+                for (std::size_t i = 0; i < _positions.size(); ++i) {
+                    const auto &chars = _nodes[_positions[i]]._chars;
+                    key[i] = std::find(chars.begin(), chars.end(), c) != chars.end();
+                    used = used || key[i];
+                }
+                if (!used) {
+                    continue;
+                }
+
+                alphabet.push_back(static_cast<char>(c));
+                if (signature.find(key) == signature.end()) {
+                    auto id = static_cast<int>(signature.size());
+                    signature[key] = id;
+                }
+                classOf[c] = signature[key];
+            }
+            auto classNum = static_cast<int>(signature.size());
+
+            auto terms = _Terms();
+            auto root = _toTerm(_root, terms);
+
+            auto res = DFA();
+            res._automata[""] = DFA::_State();
+            res._stateNum = 0;
+            res._endNum = 0;
+            res._transNum = 0;
+            res._charSet.insert(alphabet.begin(), alphabet.end());
+
+            // 项 → 状态名
+            auto name = std::unordered_map<int, std::string>({ { _Terms::EMPTY, "" } });
+            auto q = std::queue<int>();
+            auto visit = [&](int t) {
+                if (name.find(t) == name.end()) {
+                    name[t] = "s" + std::to_string(res._stateNum++);
+                    auto &state = res._automata[name[t]];
+                    if (state._isEnd = terms.nullable(t); state._isEnd) {
+                        ++res._endNum;
+                    }
+                    q.push(t);
+                }
+                return name[t];
+            };
+
+            res._start = visit(root);
+            for (; !q.empty(); q.pop()) {
+                auto t = q.front();
+                // 每个字符类只求一次导数
+                auto next = std::vector<int>(classNum, -1);
+                for (const auto ch: alphabet) {
+                    auto cls = classOf[ch];
+                    if (next[cls] == -1) {
+                        next[cls] = terms.derive(t, ch, cls, classNum);
+                    }
+                    if (next[cls] == _Terms::EMPTY) {
+                        continue;
+                    }
+
+                    auto target = visit(next[cls]);
+                    res._automata[name[t]]._transform[ch] = target;
+                    ++res._transNum;
+                }
+            }
+
+            return res.minimize();
+        }
+    };
+}
+
+#endif
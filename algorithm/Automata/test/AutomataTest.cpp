@@ -5,12 +5,25 @@
  */
 
 #define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <random>
+#include <set>
+#include <sstream>
+#include <optional>
+#include <numeric>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <regex>
 #include "../../../include/catch.hpp"
 #include "../Automata.h"
+#include "../Regex.h"
+#include "../JIT.h"
 
 using namespace std;
 using namespace Automata;
@@ -19,6 +32,10 @@ const string TEST_FILE_PATH = "compiler-principle/oj/Automata/test/";
 const int TEST_MINIMIZE_FILE_TOTAL = 6;
 const int TEST_DETERMIN_FILE_TOTAL = 2;
 const int TEST_EQUAL_FILE_TOTAL = 4;
+const vector<string> TEST_REGEX = {
+    "(a|b)*abb", "a+b?c*", "[a-c]+x", "(ab|a)*", "", "a|", "x.y",
+    "((a|b)(c|x))*y?", "[^ab]*", "a(b|)c", "(a*)*b", "\\.|[x-y]+",
+};
 
 DFA mini(int no) {
     auto inFile = ifstream(TEST_FILE_PATH + "m" + to_string(no) + "/in.txt");
@@ -48,6 +65,109 @@ bool equal(int no) {
     return nfa1.toMinimizedDFA() == nfa2.toMinimizedDFA();
 }
 
+// 在字符集alphabet上生成长度为len的随机串
+string randomInput(size_t len, const string &alphabet, unsigned seed) {
+    auto gen = mt19937(seed);
+    auto dist = uniform_int_distribution<size_t>(0, alphabet.size() - 1);
+    string res(len, ' ');
+    for (auto &ch: res) {
+        ch = alphabet[dist(gen)];
+    }
+    return res;
+}
+
+// 逐个起点运行DFA的朴素搜索 作为Matcher::search的对照
+optional<pair<size_t, size_t> > naiveSearch(const Matcher &matcher, const string &text) {
+    for (size_t pos = 0; pos <= text.size(); ++pos) {
+        auto s = matcher.start();
+        auto end = matcher.isAccept(s) ? make_optional(pos) : nullopt;
+        for (auto i = pos; i < text.size() && s != Matcher::DEAD; ) {
+            if (s = matcher.next(s, text[i++]); matcher.isAccept(s)) {
+                end = i;
+            }
+        }
+        if (end.has_value()) {
+            return make_pair(pos, end.value());
+        }
+    }
+    return nullopt;
+}
+
+// 能到达终态的状态
+vector<char> liveStates(const Matcher &matcher) {
+    auto live = vector<char>(matcher.size(), false);
+    for (auto changed = true; changed; ) {
+        changed = false;
+        for (Matcher::State s = 1; s < matcher.size(); ++s) {
+            for (int ch = 0; ch < 256 && !live[s]; ++ch) {
+                if (matcher.isAccept(s) || live[matcher.next(s, static_cast<unsigned char>(ch))]) {
+                    live[s] = changed = true;
+                }
+            }
+        }
+    }
+    return live;
+}
+
+/*
+ * 把Matcher写成DFA的输入格式再读回 用来与DFA::minimize()对照 开始状态必须能到达终态
+ * DFA::minimize()不把到不了终态的状态并入孤岛状态 所以去掉到这些状态的转移
+ * 输入格式无法表示空格 测试中空格总与'!'属于同一字符类 去掉它不影响最小状态数
+ */
+DFA asDFA(const Matcher &matcher) {
+    auto live = liveStates(matcher);
+    auto name = [](Matcher::State s) { return "q" + to_string(s); };
+    auto trans = vector<string>();
+    for (Matcher::State s = 1; s < matcher.size(); ++s) {
+        for (int ch = 33; ch <= 126; ++ch) {
+            if (auto t = matcher.next(s, static_cast<unsigned char>(ch)); live[t]) {
+                trans.push_back(name(s) + " '" + static_cast<char>(ch) + "' " + name(t));
+            }
+        }
+    }
+
+    auto ends = vector<string>();
+    auto out = ostringstream();
+    for (Matcher::State s = 1; s < matcher.size(); ++s) {
+        if (matcher.isAccept(s)) {
+            ends.push_back(name(s));
+        }
+    }
+    out << matcher.size() - 1 << " " << ends.size() << " " << trans.size() << "\n";
+    for (Matcher::State s = 1; s < matcher.size(); ++s) {
+        out << name(s) << " ";
+    }
+    out << "\n" << name(matcher.start()) << "\n";
+    for (const auto &e: ends) {
+        out << e << " ";
+    }
+    out << "\n";
+    for (const auto &t: trans) {
+        out << t << "\n";
+    }
+
+    auto in = istringstream(out.str());
+    auto res = DFA();
+    in >> res;
+    return res;
+}
+
+// 随机生成深度不超过depth的正则 字符集为{a, b}
+string randomRegex(int depth, mt19937 &gen) {
+    const auto atoms = vector<string>({ "a", "b", ".", "[ab]", "[^a]" });
+    auto kind = depth == 0 ? 0 : gen() % 6;
+    switch (kind) {
+        case 0:
+            return atoms[gen() % atoms.size()];
+        case 1:
+            return randomRegex(depth - 1, gen) + randomRegex(depth - 1, gen);
+        case 2:
+            return "(" + randomRegex(depth - 1, gen) + "|" + randomRegex(depth - 1, gen) + ")";
+        default:
+            return "(" + randomRegex(depth - 1, gen) + ")" + "*+?"[kind - 3];
+    }
+}
+
 bool ansEqu(int no) {
     auto ansFile = ifstream(TEST_FILE_PATH + "e" + to_string(no) + "/ans.txt");
     string ans = "";
@@ -73,4 +193,434 @@ TEST_CASE("Automata algorithm", "[automata]") {
             REQUIRE(equal(i) == ansEqu(i));
         }
     }
+
+    SECTION("Parallel matching") {
+        for (int i = 1; i <= TEST_MINIMIZE_FILE_TOTAL; ++i) {
+            auto matcher = mini(i).compile();
+            auto input = randomInput(1 << 20, "01", i);
+            REQUIRE(matcher.parallelRun(input, 4) == matcher.run(matcher.start(), input));
+        }
+    }
+
+    SECTION("Shuffle kernel of small DFA") {
+        for (int i = 1; i <= TEST_MINIMIZE_FILE_TOTAL; ++i) {
+            auto matcher = mini(i).compile();
+            auto input = randomInput(1 << 12, "01", i);
+            for (Matcher::State s = 0; s < matcher.size(); ++s) {
+                auto expect = s;
+                for (const auto ch: input) {
+                    expect = matcher.next(expect, ch);
+                }
+                REQUIRE(matcher.run(s, input) == expect);
+            }
+        }
+    }
+
+    SECTION("Batch matching") {
+        for (int i = 1; i <= TEST_MINIMIZE_FILE_TOTAL; ++i) {
+            auto matcher = mini(i).compile();
+            auto inputs = vector<string>();
+            for (unsigned len = 0; len < 200; ++len) {
+                inputs.push_back(randomInput(len % 13, "01", len));
+            }
+
+            auto records = vector<string_view>(inputs.begin(), inputs.end());
+            auto accepts = matcher.matchBatch(records);
+            for (size_t j = 0; j < records.size(); ++j) {
+                REQUIRE(accepts[j] == matcher.match(records[j]));
+            }
+        }
+    }
+
+    SECTION("Multi-pattern union") {
+        auto patterns = vector<NFA>();
+        for (int i = 1; i <= TEST_EQUAL_FILE_TOTAL; ++i) {
+            auto inFile = ifstream(TEST_FILE_PATH + "e" + to_string(i) + "/in.txt");
+            auto nfa1 = NFA(), nfa2 = NFA();
+            inFile >> nfa1 >> nfa2;
+            patterns.push_back(nfa1);
+            patterns.push_back(nfa2);
+        }
+
+        auto single = vector<Matcher>();
+        for (auto &nfa: patterns) {
+            single.push_back(nfa.toMinimizedDFA().compile());
+        }
+        auto united = NFA::unite(patterns).toMinimizedDFA().compile();
+
+        for (unsigned j = 0; j < 500; ++j) {
+            auto input = randomInput(j % 6, "01ab", j);
+            auto expect = vector<int>();
+            for (int k = 0; k < static_cast<int>(single.size()); ++k) {
+                if (single[k].match(input)) {
+                    expect.push_back(k);
+                }
+            }
+            REQUIRE(united.matchPatterns(input) == expect);
+        }
+    }
+
+    SECTION("Aho-Corasick keyword automaton") {
+        auto keywords = vector<string>({ "he", "she", "his", "hers", "e", "she" });
+        for (unsigned j = 0; j < 50; ++j) {
+            keywords.push_back(randomInput(1 + j % 4, "ehrs", j));
+        }
+        auto matcher = AhoCorasick(keywords).compile();
+
+        for (unsigned j = 0; j < 20; ++j) {
+            auto text = randomInput(200, "ehirsx", j);
+            auto found = set<pair<size_t, int> >(), expect = set<pair<size_t, int> >();
+
+            matcher.scan(text, [&found](size_t end, int pattern) {
+                found.insert({ end, pattern });
+            });
+            for (int k = 0; k < static_cast<int>(keywords.size()); ++k) {
+                for (auto pos = text.find(keywords[k]); pos != string::npos;
+                    pos = text.find(keywords[k], pos + 1)) {
+                    expect.insert({ pos + keywords[k].size(), k });
+                }
+            }
+            REQUIRE(found == expect);
+        }
+    }
+
+    SECTION("Search with literal prefilter") {
+        auto literal = DFA();
+        auto in = istringstream("5 1 5\nA B C D E\nA\nE\n"
+            "A \"x\" B\nB \"y\" C\nC \"z\" D\nD \"0\" E\nD \"1\" E\n");
+        in >> literal;
+
+        auto matchers = vector<Matcher>({ literal.minimize().compile() });
+        for (int i = 1; i <= TEST_MINIMIZE_FILE_TOTAL; ++i) {
+            matchers.push_back(mini(i).compile());
+        }
+
+        for (const auto &matcher: matchers) {
+            for (unsigned j = 0; j < 50; ++j) {
+                auto text = randomInput(j * 7, "xyz01", j);
+                REQUIRE(matcher.search(text) == naiveSearch(matcher, text));
+            }
+        }
+    }
+
+    SECTION("Comb vector compression") {
+        auto matchers = vector<Matcher>();
+        for (int i = 1; i <= TEST_MINIMIZE_FILE_TOTAL; ++i) {
+            matchers.push_back(mini(i).compile());
+        }
+        matchers.push_back(AhoCorasick({ "he", "she", "his", "hers" }).compile());
+
+        for (const auto &dense: matchers) {
+            auto compressed = CompressedMatcher(dense);
+            REQUIRE(compressed.start() == dense.start());
+            for (Matcher::State s = 0; s < dense.size(); ++s) {
+                REQUIRE(compressed.isAccept(s) == dense.isAccept(s));
+                for (int ch = 0; ch < 256; ++ch) {
+                    REQUIRE(compressed.next(s, ch) == dense.next(s, ch));
+                }
+            }
+        }
+    }
+
+    SECTION("Profile-guided state relayout") {
+        for (int i = 1; i <= TEST_MINIMIZE_FILE_TOTAL; ++i) {
+            auto matcher = mini(i).compile();
+            auto sample = randomInput(1000, "01", i);
+            auto visits = vector<size_t>();
+            matcher.profile(sample, visits);
+            REQUIRE(accumulate(visits.begin(), visits.end(), size_t(0)) == sample.size() + 1);
+
+            auto bfs = matcher.relayout(), hot = matcher.relayout(visits);
+            REQUIRE(bfs.start() == 1);
+            for (unsigned j = 0; j < 100; ++j) {
+                auto input = randomInput(j % 20, "01", j);
+                REQUIRE(bfs.match(input) == matcher.match(input));
+                REQUIRE(hot.match(input) == matcher.match(input));
+            }
+        }
+    }
+
+    SECTION("Lazy product automata") {
+        using Op = Product::Operation;
+        const auto ops = { Op::INTERSECTION, Op::UNION, Op::DIFFERENCE, Op::SYMMETRIC_DIFFERENCE };
+
+        for (int i = 1; i <= TEST_MINIMIZE_FILE_TOTAL; ++i) {
+            auto lhs = mini(i).compile();
+            auto rhs = mini(i % TEST_MINIMIZE_FILE_TOTAL + 1).compile();
+
+            for (const auto op: ops) {
+                auto product = Product(lhs, rhs, op);
+                auto materialized = product.materialize();
+                auto empty = true;
+
+                for (unsigned j = 0; j < 300; ++j) {
+                    auto input = randomInput(j % 10, "01", j);
+                    auto a = lhs.match(input), b = rhs.match(input);
+                    auto expect = op == Op::INTERSECTION ? a && b
+                        : op == Op::UNION ? a || b
+                        : op == Op::DIFFERENCE ? a && !b : a != b;
+                    REQUIRE(product.match(input) == expect);
+                    REQUIRE(materialized.match(input) == expect);
+                    empty = empty && !expect;
+                }
+                if (!empty) {
+                    REQUIRE(!product.isEmpty());
+                }
+            }
+
+            // 与标准答案等价 <=> 对称差为空
+            auto ans = ansDFA(i, string("m")).compile();
+            REQUIRE(Product(lhs, ans, Op::SYMMETRIC_DIFFERENCE).isEmpty());
+            REQUIRE(Product(lhs, lhs, Op::DIFFERENCE).materialize().size() == 1);
+        }
+    }
+
+    SECTION("Read-only queries") {
+        for (int i = 1; i <= TEST_MINIMIZE_FILE_TOTAL; ++i) {
+            auto inFile = ifstream(TEST_FILE_PATH + "m" + to_string(i) + "/in.txt");
+            auto dfa = DFA();
+            inFile >> dfa;
+
+            const auto &view = dfa;
+            auto before = ostringstream(), after = ostringstream();
+            before << view;
+            auto minimized = view.minimize();
+            after << view;
+            // minimize()不修改原DFA
+            REQUIRE(before.str() == after.str());
+
+            auto matcher = minimized.compile();
+            for (unsigned j = 0; j < 100; ++j) {
+                auto input = randomInput(j % 12, "01", j);
+                REQUIRE(view.accept(input) == matcher.match(input));
+                REQUIRE(minimized.accept(input) == matcher.match(input));
+            }
+            REQUIRE(!view.contains("not a state"));
+            REQUIRE(view.next("not a state", '0') == "");
+        }
+    }
+
+    SECTION("Hot swap of shared matcher") {
+        auto versions = vector<shared_ptr<const Matcher> >();
+        for (int i = 1; i <= TEST_MINIMIZE_FILE_TOTAL; ++i) {
+            versions.push_back(mini(i).freeze());
+        }
+
+        auto shared = SharedMatcher(versions.front());
+        auto inputs = vector<string>();
+        for (unsigned j = 0; j < 64; ++j) {
+            inputs.push_back(randomInput(j % 9, "01", j));
+        }
+
+        // 每个版本对每条输入的结果 在替换开始前算好
+        auto expect = vector<vector<bool> >();
+        for (const auto &version: versions) {
+            expect.emplace_back();
+            for (const auto &input: inputs) {
+                expect.back().push_back(version->match(input));
+            }
+        }
+
+        auto done = atomic<bool>(false);
+        auto errors = atomic<int>(0);
+        auto readers = vector<thread>();
+        for (int r = 0; r < 4; ++r) {
+            readers.emplace_back([&] {
+                while (!done.load()) {
+                    auto snapshot = shared.load();
+                    auto owner = find(versions.begin(), versions.end(), snapshot);
+                    if (owner == versions.end()) {
+                        ++errors;
+                        continue;
+                    }
+                    const auto &answers = expect[owner - versions.begin()];
+                    for (size_t j = 0; j < inputs.size(); ++j) {
+                        if (snapshot->match(inputs[j]) != answers[j]) {
+                            ++errors;
+                        }
+                    }
+                }
+            });
+        }
+
+        for (int k = 0; k < 1000; ++k) {
+            shared.store(versions[k % versions.size()]);
+        }
+        done = true;
+        for (auto &reader: readers) {
+            reader.join();
+        }
+        REQUIRE(errors.load() == 0);
+    }
+
+    SECTION("Glushkov regex compiler") {
+        for (const auto &pattern: TEST_REGEX) {
+            auto nfa = Regex(pattern).toNFA();
+            auto matcher = nfa.toMinimizedDFA().compile();
+            auto oracle = regex(pattern);
+
+            for (unsigned j = 0; j < 300; ++j) {
+                auto input = randomInput(j % 8, "abcxy.", j);
+                REQUIRE(matcher.match(input) == regex_match(input, oracle));
+            }
+        }
+        REQUIRE_THROWS_AS(Regex("(ab"), invalid_argument);
+        REQUIRE_THROWS_AS(Regex("a)"), invalid_argument);
+        REQUIRE_THROWS_AS(Regex("*a"), invalid_argument);
+    }
+
+    SECTION("Brzozowski derivative compiler") {
+        auto patterns = TEST_REGEX;
+        patterns.insert(patterns.end(), {
+            "(.|(((.)?|([ab])*))*)", "([ab].b|([^a])+..)(((.|[^a]))?)*", "(([^a]|([ab].)*))+",
+        });
+        auto gen = mt19937(0);
+        for (int i = 0; i < 300; ++i) {
+            patterns.push_back(randomRegex(1 + i % 5, gen));
+        }
+
+        for (const auto &pattern: patterns) {
+            CAPTURE(pattern);
+            auto regex = Regex(pattern);
+            auto derived = regex.toDFA();
+            auto minimized = regex.toNFA().toMinimizedDFA();
+
+            // 导数构造的DFA就是最小DFA
+            REQUIRE(derived == minimized);
+            auto lhs = derived.compile(), rhs = minimized.compile();
+            REQUIRE(Product(lhs, rhs, Product::Operation::SYMMETRIC_DIFFERENCE).isEmpty());
+            REQUIRE(lhs.size() == rhs.size());
+        }
+
+        // std::regex回溯匹配 嵌套的重复会指数爆炸 只用于固定的正则
+        for (const auto &pattern: TEST_REGEX) {
+            auto matcher = Regex(pattern).toDFA().compile();
+            auto oracle = std::regex(pattern);
+            for (unsigned j = 0; j < 300; ++j) {
+                auto input = randomInput(j % 8, "abcxy.", j);
+                REQUIRE(matcher.match(input) == regex_match(input, oracle));
+            }
+        }
+    }
+
+    SECTION("x86-64 JIT") {
+        auto matchers = vector<Matcher>();
+        for (int i = 1; i <= TEST_MINIMIZE_FILE_TOTAL; ++i) {
+            matchers.push_back(mini(i).compile());
+        }
+        for (const auto &pattern: TEST_REGEX) {
+            matchers.push_back(Regex(pattern).toDFA().compile());
+        }
+        matchers.push_back(AhoCorasick({ "he", "she", "his", "hers", "xy", "ab" }).compile());
+
+        for (const auto &matcher: matchers) {
+            auto jit = JITMatcher(matcher);
+            for (unsigned j = 0; j < 50; ++j) {
+                auto input = randomInput(j * 3, "01abcxyhesr.", j);
+                for (Matcher::State s = 0; s < matcher.size(); ++s) {
+                    REQUIRE(jit.run(s, input) == matcher.run(s, input));
+                }
+            }
+        }
+    }
+
+    SECTION("Incremental minimization") {
+        // s3 -a→ s1 s1 -b→ s2 s2 -b→ s1 s2和s3是终态
+        // s1改为终态后 s1和s2互相依赖而等价 必须一起合并
+        auto in = istringstream("3 2 3\ns1 s2 s3\ns3\ns2 s3\ns1 'b' s2\ns2 'b' s1\ns3 'a' s1\n");
+        auto cycle = DFA();
+        in >> cycle;
+        auto incremental = IncrementalDFA(cycle.compile());
+        auto s1 = incremental.next(incremental.current().start(), 'a');
+        incremental.setAccept(s1, true);
+        REQUIRE(incremental.blockNum() == IncrementalDFA(incremental.current()).blockNum());
+        REQUIRE(incremental.blockOf(s1) == incremental.blockOf(incremental.next(s1, 'b')));
+        REQUIRE(incremental.toMatcher().size() == asDFA(incremental.current()).minimize().compile().size());
+
+        // s2 -c→ s1 s2 -a,x→ s3 s3 -x→ s1 s3 -a,c→ s2 只有s1是终态
+        // s1改为非终态后与死状态等价 s2和s3随之也与死状态等价
+        in = istringstream("3 1 6\ns1 s2 s3\ns2\ns1\n"
+                           "s2 'c' s1\ns2 'x' s3\ns2 'a' s3\ns3 'x' s1\ns3 'c' s2\ns3 'a' s2\n");
+        auto chain = DFA();
+        in >> chain;
+        incremental = IncrementalDFA(chain.compile());
+        s1 = incremental.next(incremental.current().start(), 'c');
+        incremental.setAccept(s1, false);
+        REQUIRE(incremental.blockNum() == IncrementalDFA(incremental.current()).blockNum());
+        REQUIRE(incremental.toMatcher().size() == 1);
+
+        // 随机的修改序列 每次修改后块数和划分都与重新构造的结果一致
+        auto patterns = TEST_REGEX;
+        auto gen = mt19937(1);
+        for (int i = 0; i < 300; ++i) {
+            patterns.push_back(randomRegex(1 + i % 4, gen));
+        }
+        for (std::size_t i = 0; i < patterns.size(); ++i) {
+            const auto &pattern = patterns[i];
+            CAPTURE(pattern);
+            auto dfa = IncrementalDFA(Regex(pattern).toNFA().determine().compile());
+            auto rng = mt19937(static_cast<unsigned>(i));
+            const auto alphabet = string("abcxy.");
+
+            for (int j = 0; j < 100; ++j) {
+                auto s = static_cast<Matcher::State>(rng() % dfa.size());
+                if (j % 10 == 9) {
+                    s = dfa.addState();
+                }
+                if (rng() % 3 == 0) {
+                    dfa.setAccept(s, !dfa.isAccept(s));
+                } else {
+                    auto t = static_cast<Matcher::State>(rng() % dfa.size());
+                    dfa.setTransition(s, alphabet[rng() % alphabet.size()], t);
+                }
+
+                auto current = dfa.current();
+                auto fresh = IncrementalDFA(current);
+                CAPTURE(j);
+                REQUIRE(dfa.blockNum() == fresh.blockNum());
+                auto same = true;
+                for (Matcher::State x = 0; x < dfa.size(); ++x) {
+                    for (Matcher::State y = 0; y < x; ++y) {
+                        same = same && (dfa.blockOf(x) == dfa.blockOf(y)) == (fresh.blockOf(x) == fresh.blockOf(y));
+                    }
+                }
+                REQUIRE(same);
+
+                // 与DFA::minimize()对照 代价较高 隔几次修改做一次
+                if (j % 10 != 0) {
+                    continue;
+                }
+                auto minimized = dfa.toMatcher();
+                REQUIRE(minimized.size() == fresh.toMatcher().size());
+                if (liveStates(current)[current.start()]) {
+                    REQUIRE(minimized.size() == asDFA(current).minimize().compile().size());
+                }
+                REQUIRE(Product(minimized, current, Product::Operation::SYMMETRIC_DIFFERENCE).isEmpty());
+            }
+        }
+    }
+}
+
+// 默认不运行 使用 AutomataTest "[benchmark]" 运行
+TEST_CASE("JIT versus table", "[.][benchmark]") {
+    auto matcher = Regex("(a|b)*a(a|b)(a|b)(a|b)(a|b)").toDFA().compile();
+    auto jit = JITMatcher(matcher);
+    auto random = randomInput(1 << 20, "ab", 0);
+    auto repeated = string();
+    while (repeated.size() < random.size()) {
+        repeated += "aab";
+    }
+
+    BENCHMARK("table, random input") {
+        return matcher.run(matcher.start(), random);
+    };
+    BENCHMARK("jit, random input") {
+        return jit.run(jit.start(), random);
+    };
+    BENCHMARK("table, repeated input") {
+        return matcher.run(matcher.start(), repeated);
+    };
+    BENCHMARK("jit, repeated input") {
+        return jit.run(jit.start(), repeated);
+    };
 }
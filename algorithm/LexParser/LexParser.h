@@ -9,11 +9,35 @@
 
 #include <iostream>
 #include <string>
-#include <unordered_map>
-#include <cctype>
+#include <stdexcept>
 #include <utility>
 #include <variant>
 #include <optional>
+#include <array>
+#include <string_view>
+#include <iterator>
+#include <system_error>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include "../ReservedWords.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define __COMPILER_LEX_PARSER_X86_
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define __COMPILER_LEX_PARSER_MMAP_
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace Compiler {
     // 类别表
@@ -50,7 +74,7 @@ namespace Compiler {
     }
 
     // 保留字表
-    const auto reserved = std::unordered_map<std::string, Symbol>({
+    inline constexpr auto reserved = ReservedWords<Symbol, 5>({
         { "BEGIN",  Symbol::BEGIN },
         { "END",    Symbol::END },
         { "IF",     Symbol::IF },
@@ -84,73 +108,528 @@ namespace Compiler {
         }
     };
 
+#ifdef __COMPILER_LEX_PARSER_MMAP_
+    // 只读映射到内存的文件 配合LexParser的缓冲区模式使用
+    // 文件内容之后总有一个'\0'作为哨兵
+    class MappedFile {
+    private:
+        static constexpr char _EMPTY[1] = { '\0' };
+
+        const char *_data = _EMPTY;
+        std::size_t _size = 0;
+        // 映射区间的长度 包含哨兵所在的页
+        std::size_t _length = 0;
+
+    public:
+        MappedFile(const std::string &path) {
+            auto fd = ::open(path.c_str(), O_RDONLY);
+            if (fd == -1) {
+                throw std::system_error(errno, std::generic_category(), path);
+            }
+
+            struct stat st;
+            if (::fstat(fd, &st) == -1) {
+                auto err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::generic_category(), path);
+            }
+
+            _size = static_cast<std::size_t>(st.st_size);
+            if (_size != 0) {
+                // 先保留多一页的匿名映射(全零) 再把文件映射到它的开头
+                // 文件恰好占满整页时 哨兵落在多出的那一页上
+                auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+                _length = (_size / page + 1) * page;
+                auto base = ::mmap(nullptr, _length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                auto addr = base == MAP_FAILED ? MAP_FAILED :
+                    ::mmap(base, _size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+                if (addr == MAP_FAILED) {
+                    auto err = errno;
+                    if (base != MAP_FAILED) {
+                        ::munmap(base, _length);
+                    }
+                    ::close(fd);
+                    throw std::system_error(err, std::generic_category(), path);
+                }
+                // 顺序扫描 提示内核预读
+                ::madvise(addr, _size, MADV_SEQUENTIAL);
+                _data = static_cast<const char *>(addr);
+            }
+            ::close(fd);
+        }
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        ~MappedFile() {
+            if (_length != 0) {
+                ::munmap(const_cast<char *>(_data), _length);
+            }
+        }
+
+        std::string_view view() const { return { _data, _size }; }
+    };
+#endif
+
+    // 标识符驻留表
+    // 开放定址(线性探测)的哈希表 名字的字节连续存放在分块的arena中
+    // 每个不同的名字对应一个从0开始连续编号的id
+    class InternTable {
+    private:
+        static constexpr std::uint32_t _EMPTY = std::numeric_limits<std::uint32_t>::max();
+        static constexpr std::size_t _BLOCK_SIZE = 1 << 16;
+
+        // 槽位中存放id 哈希值的低32位和名字 命中时只需访问槽位和arena
+        struct _Slot {
+            std::uint32_t id;
+            std::uint32_t hash;
+            std::string_view name;
+        };
+
+        // 容量是2的幂 装载因子不超过1/2
+        std::vector<_Slot> _slots = std::vector<_Slot>(64, { _EMPTY, 0, { } });
+        // id → 名字(指向arena)
+        std::vector<std::string_view> _names;
+        // arena 分块分配 已分配的名字不会移动
+        std::vector<std::unique_ptr<char[]> > _blocks;
+        char *_top = nullptr;
+        std::size_t _left = 0;
+
+        // 每次混入8个字节 标识符通常很短 比逐字节的哈希快
+        static std::uint32_t _hash(std::string_view name) {
+            constexpr auto MUL = 0xbf58476d1ce4e5b9ULL;
+            auto h = static_cast<std::uint64_t>(name.size()) * 0x9e3779b97f4a7c15ULL;
+            auto p = name.data();
+            auto n = name.size();
+            for (; n >= 8; p += 8, n -= 8) {
+                auto word = std::uint64_t();
+                std::memcpy(&word, p, 8);
+                h = (h ^ word) * MUL;
+                h ^= h >> 31;
+            }
+            if (n != 0) {
+                auto word = std::uint64_t();
+                std::memcpy(&word, p, n);
+                h = (h ^ word) * MUL;
+                h ^= h >> 31;
+            }
+            h *= MUL;
+            return static_cast<std::uint32_t>(h ^ (h >> 32));
+        }
+
+        std::string_view _store(std::string_view name) {
+            if (name.size() > _left) {
+                // 过长的名字单独占一块
+                auto size = std::max(_BLOCK_SIZE, name.size());
+                _blocks.emplace_back(new char[size]);
+                _top = _blocks.back().get();
+                _left = size;
+            }
+            std::memcpy(_top, name.data(), name.size());
+            auto res = std::string_view(_top, name.size());
+            _top += name.size();
+            _left -= name.size();
+            return res;
+        }
+
+        // 扩容时用槽位中保存的哈希值 不必重新计算
+        void _grow() {
+            auto slots = std::vector<_Slot>(_slots.size() * 2, { _EMPTY, 0, { } });
+            auto mask = slots.size() - 1;
+            for (const auto &slot: _slots) {
+                if (slot.id == _EMPTY) {
+                    continue;
+                }
+                auto pos = slot.hash & mask;
+                while (slots[pos].id != _EMPTY) {
+                    pos = (pos + 1) & mask;
+                }
+                slots[pos] = slot;
+            }
+            _slots.swap(slots);
+        }
+
+    public:
+        InternTable() = default;
+        InternTable(const InternTable &) = delete;
+        InternTable &operator=(const InternTable &) = delete;
+        ~InternTable() { }
+
+        // 返回名字的id 第一次出现时分配新的id
+        std::uint32_t intern(std::string_view name) {
+            auto hash = _hash(name);
+            auto mask = _slots.size() - 1;
+            auto pos = hash & mask;
+            for (; _slots[pos].id != _EMPTY; pos = (pos + 1) & mask) {
+                if (_slots[pos].hash == hash && _slots[pos].name == name) {
+                    return _slots[pos].id;
+                }
+            }
+
+            auto id = static_cast<std::uint32_t>(_names.size());
+            _names.push_back(_store(name));
+            _slots[pos] = { id, hash, _names.back() };
+            if (_names.size() * 2 > _slots.size()) {
+                _grow();
+            }
+            return id;
+        }
+
+        std::string_view name(std::uint32_t id) const { return _names[id]; }
+
+        std::size_t size() const { return _names.size(); }
+    };
+
+    // 批量分析的结果 按列存放 不为每个单词分配内存
+    // 单词的文本通过偏移和长度指向源缓冲区
+    struct TokenStream {
+        // 整数超过2147483647时在values中的值
+        static constexpr int INTEGER_OVERFLOW = -1;
+
+        std::string_view source;
+        // 类别
+        std::vector<std::int8_t> symbols;
+        // 在source中的偏移
+        std::vector<std::size_t> offsets;
+        // 长度 超过4GiB的注释记为UINT32_MAX
+        std::vector<std::uint32_t> lengths;
+        // 按出现顺序存放每个INTEGER单词的值
+        std::vector<int> values;
+        // 按出现顺序存放每个IDENTIFIER单词在分析器驻留表中的id
+        std::vector<std::uint32_t> identifiers;
+
+        std::size_t size() const { return symbols.size(); }
+
+        Symbol symbol(std::size_t i) const { return static_cast<Symbol>(symbols[i]); }
+
+        std::string_view text(std::size_t i) const { return source.substr(offsets[i], lengths[i]); }
+    };
+
+    // 测试用 可以直接调用LexParser的各个内核
+    struct LexParserTest;
+
     // 词法分析器
+    // 在连续的缓冲区上用指针扫描 从流构造时逐行读入 parseAll之前再读完剩下的部分
+    // 缓冲区之后必须紧跟一个'\0'作为哨兵 EOF只是读到了末尾的哨兵 不使用异常
+    // 核心是按字符类查表的DFA 状态转移表对应README中的文法
     class LexParser {
+        friend struct LexParserTest;
+
     private:
-        // 读入EOF抛出的异常
-        class _EOFException { };
+        // 字符类
+        enum _Class : unsigned char {
+            _OTHER, _BLANK, _LETTER, _DIGIT, _COLON, _EQU, _PLUS, _MINUS, _STAR,
+            _DIVIDE, _LBRACKET, _RBRACKET, _COMMA, _SEMI, _NUL, _CLASS_NUM,
+        };
 
-        std::istream &_in;  // 绑定的流 默认是stdin
-        std::string _token;
-        int _ch;
-        Symbol _symbol;     // 存储类别 用于异常处理时的返回
+        // DFA的状态 转移表中不小于_STATE_NUM的值是接受动作
+        enum _State : unsigned char {
+            _S_START, _S_IDENTIFIER, _S_INTEGER, _S_COLON, _S_DIVIDE,
+            _S_COMMENT, _S_COMMENT_STAR, _STATE_NUM,
+        };
 
-        inline void init() {
-            _token = "";
-            _symbol = Symbol::INIT;
+        // 接受动作 下标加上_STATE_NUM后存放在转移表中
+        enum _Action : unsigned char {
+            _A_IDENTIFIER, _A_INTEGER, _A_COLON, _A_DIVIDE, _A_ASSIGN, _A_EQUAL,
+            _A_PLUS, _A_MINUS, _A_STAR, _A_LBRACKET, _A_RBRACKET, _A_COMMA, _A_SEMI,
+            _A_COMMENT, _A_UNDEFINED,
+            // 读到'\0' 是否真的到了EOF要看位置
+            _A_EOF, _A_INCOMPLETECOMMENT,
+        };
+
+        // 接受时得到的类别 以及是否退回最后读入的字符
+        struct _Accept {
+            Symbol symbol;
+            bool retract;
+        };
+
+        static constexpr _Accept _ACCEPTS[] = {
+            { Symbol::IDENTIFIER, true },
+            { Symbol::INTEGER, true },
+            { Symbol::COLON, true },
+            { Symbol::DIVIDE, true },
+            { Symbol::ASSIGN, false },
+            { Symbol::EQUAL, false },
+            { Symbol::PLUS, false },
+            { Symbol::MINUS, false },
+            { Symbol::STAR, false },
+            { Symbol::LBRACKET, false },
+            { Symbol::RBRACKET, false },
+            { Symbol::COMMA, false },
+            { Symbol::SEMI, false },
+            { Symbol::COMMENT, false },
+            { Symbol::UNDEFINED, false },
+            { Symbol::SEOF, true },
+            { Symbol::INCOMPLETECOMMENT, true },
+        };
+
+        using _ClassTable = std::array<unsigned char, 256>;
+        using _TransitionTable = std::array<std::array<unsigned char, _CLASS_NUM>, _STATE_NUM>;
+
+        // 只认ASCII字母和数字 与locale无关
+        static constexpr _ClassTable _makeClasses() {
+            auto res = _ClassTable();
+            for (int ch = 'a'; ch <= 'z'; ++ch) {
+                res[ch] = _LETTER;
+            }
+            for (int ch = 'A'; ch <= 'Z'; ++ch) {
+                res[ch] = _LETTER;
+            }
+            for (int ch = '0'; ch <= '9'; ++ch) {
+                res[ch] = _DIGIT;
+            }
+            res[' '] = res['\t'] = res['\n'] = res['\r'] = _BLANK;
+            res[':'] = _COLON;
+            res['='] = _EQU;
+            res['+'] = _PLUS;
+            res['-'] = _MINUS;
+            res['*'] = _STAR;
+            res['/'] = _DIVIDE;
+            res['('] = _LBRACKET;
+            res[')'] = _RBRACKET;
+            res[','] = _COMMA;
+            res[';'] = _SEMI;
+            res['\0'] = _NUL;
+            return res;
+        }
+
+        static constexpr unsigned char _accept(_Action action) { return _STATE_NUM + action; }
+
+        static constexpr _TransitionTable _makeTransitions() {
+            auto res = _TransitionTable();
+
+            // 开始状态 空白已在进入DFA之前整段跳过
+            auto &start = res[_S_START];
+            for (auto &next: start) {
+                next = _accept(_A_UNDEFINED);
+            }
+            start[_BLANK] = _S_START;
+            start[_LETTER] = _S_IDENTIFIER;
+            start[_DIGIT] = _S_INTEGER;
+            start[_COLON] = _S_COLON;
+            start[_DIVIDE] = _S_DIVIDE;
+            start[_EQU] = _accept(_A_EQUAL);
+            start[_PLUS] = _accept(_A_PLUS);
+            start[_MINUS] = _accept(_A_MINUS);
+            start[_STAR] = _accept(_A_STAR);
+            start[_LBRACKET] = _accept(_A_LBRACKET);
+            start[_RBRACKET] = _accept(_A_RBRACKET);
+            start[_COMMA] = _accept(_A_COMMA);
+            start[_SEMI] = _accept(_A_SEMI);
+            start[_NUL] = _accept(_A_EOF);
+
+            // 最长匹配 遇到不能继续的字符就接受并退回该字符
+            for (int c = 0; c < _CLASS_NUM; ++c) {
+                res[_S_IDENTIFIER][c] = _accept(_A_IDENTIFIER);
+                res[_S_INTEGER][c] = _accept(_A_INTEGER);
+                res[_S_COLON][c] = _accept(_A_COLON);
+                res[_S_DIVIDE][c] = _accept(_A_DIVIDE);
+                res[_S_COMMENT][c] = _S_COMMENT;
+                res[_S_COMMENT_STAR][c] = _S_COMMENT;
+            }
+            res[_S_IDENTIFIER][_LETTER] = res[_S_IDENTIFIER][_DIGIT] = _S_IDENTIFIER;
+            res[_S_INTEGER][_DIGIT] = _S_INTEGER;
+            res[_S_COLON][_EQU] = _accept(_A_ASSIGN);
+            res[_S_DIVIDE][_STAR] = _S_COMMENT;
+
+            // 注释 '*'之后紧跟'/'时结束
+            res[_S_COMMENT][_STAR] = _S_COMMENT_STAR;
+            res[_S_COMMENT][_NUL] = _accept(_A_INCOMPLETECOMMENT);
+            res[_S_COMMENT_STAR][_STAR] = _S_COMMENT_STAR;
+            res[_S_COMMENT_STAR][_DIVIDE] = _accept(_A_COMMENT);
+            res[_S_COMMENT_STAR][_NUL] = _accept(_A_INCOMPLETECOMMENT);
+            return res;
+        }
+
+        // 在类外定义 constexpr函数在类定义完成之后才能求值
+        static const _ClassTable _CLASSES;
+        static const _TransitionTable _TRANSITIONS;
+
+        std::string _owned;     // 从流构造时持有的缓冲区
+        std::istream *_in;      // 还没有读完的流 缓冲区模式下为nullptr
+        const char *_begin;
+        const char *_cur;       // 下一个要读的字符
+        const char *_end;       // 哨兵的位置
+        std::string_view _token;
+        Symbol _symbol;
+        InternTable _identifiers;
+
+        static inline auto classOf(const char *p) { return _CLASSES[static_cast<unsigned char>(*p)]; }
+
+        // 可以整段跳过的串: 标识符的剩余部分 整数 空白
+        enum _Run { _RUN_ALNUM, _RUN_DIGIT, _RUN_BLANK };
+
+        template <_Run run>
+        static inline bool inRun(const char *p) {
+            auto cls = classOf(p);
+            if constexpr (run == _RUN_ALNUM) {
+                return cls == _LETTER || cls == _DIGIT;
+            } else if constexpr (run == _RUN_DIGIT) {
+                return cls == _DIGIT;
+            } else {
+                return cls == _BLANK;
+            }
+        }
+
+        static bool hasAVX2() {
+#ifdef __COMPILER_LEX_PARSER_X86_
+            static const bool res = __builtin_cpu_supports("avx2");
+            return res;
+#else
+            return false;
+#endif
+        }
+
+        static bool hasSSE42() {
+#ifdef __COMPILER_LEX_PARSER_X86_
+            static const bool res = __builtin_cpu_supports("sse4.2");
+            return res;
+#else
+            return false;
+#endif
+        }
+
+#ifdef __COMPILER_LEX_PARSER_X86_
+        // lo <= x <= hi 按无符号字节比较
+        __attribute__((target("avx2")))
+        static inline __m256i betweenAVX2(__m256i x, char lo, char hi) {
+            auto t = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+            return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(hi - lo)), t);
+        }
+
+        // 一次判断32个字节 剩下不足32个字节时逐字节判断
+        template <_Run run>
+        __attribute__((target("avx2")))
+        static const char *skipRunAVX2(const char *p, const char *limit) {
+            for (; limit - p >= 32; p += 32) {
+                auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+                auto hit = _mm256_setzero_si256();
+                if constexpr (run == _RUN_ALNUM) {
+                    // 'A'-'Z'和'a'-'z'或上0x20后都落在'a'-'z'中
+                    hit = _mm256_or_si256(betweenAVX2(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 'z'),
+                        betweenAVX2(x, '0', '9'));
+                } else if constexpr (run == _RUN_DIGIT) {
+                    hit = betweenAVX2(x, '0', '9');
+                } else {
+                    hit = _mm256_or_si256(
+                        _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t'))),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')),
+                            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r'))));
+                }
+
+                if (auto miss = ~static_cast<unsigned>(_mm256_movemask_epi8(hit)); miss != 0) {
+                    return p + __builtin_ctz(miss);
+                }
+            }
+            return skipRunScalar<run>(p);
+        }
+
+        // pcmpistri一次判断16个字节 遇到'\0'时也会停下 剩下不足16个字节时逐字节判断
+        template <_Run run>
+        __attribute__((target("sse4.2")))
+        static const char *skipRunSSE42(const char *p, const char *limit) {
+            // 范围或字符集合 以'\0'结尾
+            alignas(16) static constexpr char sets[][16] = { "azAZ09", "09", " \t\n\r" };
+            constexpr auto mode = _SIDD_UBYTE_OPS | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT
+                | (run == _RUN_BLANK ? _SIDD_CMP_EQUAL_ANY : _SIDD_CMP_RANGES);
+            const auto set = _mm_load_si128(reinterpret_cast<const __m128i *>(sets[run]));
+
+            for (; limit - p >= 16; p += 16) {
+                auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                if (auto index = _mm_cmpistri(set, x, mode); index != 16) {
+                    return p + index;
+                }
+            }
+            return skipRunScalar<run>(p);
+        }
+#endif
+
+        // 逐字节查类别表 没有SIMD时使用
+        template <_Run run>
+        static inline const char *skipRunScalar(const char *p) {
+            while (inRun<run>(p)) {
+                ++p;
+            }
+            return p;
         }
 
-        // 读取字符 遇到EOF抛出异常
-        inline void getChar() {
-            if (_ch = _in.get(); _in.eof()) {
-                throw _EOFException();
+        // 返回从p开始第一个不属于该串的位置 哨兵不属于任何串 所以一定会停下
+        // 向量读入不越过哨兵 limit是哨兵的下一个位置
+        template <_Run run>
+        inline const char *skipRun(const char *p) const {
+#ifdef __COMPILER_LEX_PARSER_X86_
+            if (hasAVX2()) {
+                return skipRunAVX2<run>(p, _end + 1);
             }
+            if (hasSSE42()) {
+                return skipRunSSE42<run>(p, _end + 1);
+            }
+#endif
+            return skipRunScalar<run>(p);
         }
 
-        inline void ungetChar() {
-            _in.unget();
+        inline void init() {
+            _token = { };
+            _symbol = Symbol::INIT;
         }
 
         // 判断保留字
         inline void checkReserved() {
-            if (auto res = reserved.find(_token); res == reserved.end()) {
+            if (auto res = reserved.find(_token); res.has_value()) {
+                // 保留字
+                _symbol = res.value();
+            } else {
                 // 标识符
                 _symbol = Symbol::IDENTIFIER;
-            } else {
-                // 保留字
-                _symbol = res->second;
             }
         }
 
-        inline void catToken() {
-            _token += _ch;
-            getChar();
+        // 8个ASCII数字转换为整数 p[0]是最高位
+        // 每一步把相邻的两组合并: 8个1位 → 4个2位 → 2个4位 → 1个8位
+        static inline std::uint32_t parseEightDigits(const char *p) {
+            auto v = std::uint64_t();
+            std::memcpy(&v, p, 8);
+            v -= 0x3030303030303030ULL;
+            v = v * 10 + (v >> 8);
+            v = ((v & 0x000000ff000000ffULL) * (100 + (1000000ULL << 32))
+                + ((v >> 16) & 0x000000ff000000ffULL) * (1 + (10000ULL << 32))) >> 32;
+            return static_cast<std::uint32_t>(v);
         }
 
-        // 使用std::stoi判断是否溢出
-        inline std::optional<int> parseInteger() {
-            try {
-                int num = std::stoi(_token);
-                return std::make_optional<int>(num);
-            } catch (std::out_of_range &e) {
+        // 跳过前导零后超过10位一定溢出 否则在64位中累加不会回绕
+        // 超过2147483647时返回std::nullopt
+        inline std::optional<int> parseInteger() const {
+            auto p = _token.data(), end = p + _token.size();
+            while (p != end && *p == '0') {
+                ++p;
+            }
+            if (end - p > 10) {
                 return std::nullopt;
             }
+
+            auto value = std::uint64_t();
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            if (end - p >= 8) {
+                value = parseEightDigits(p);
+                p += 8;
+            }
+#endif
+            for (; p != end; ++p) {
+                value = value * 10 + static_cast<std::uint64_t>(*p - '0');
+            }
+
+            if (value > static_cast<std::uint64_t>(std::numeric_limits<int>::max())) {
+                return std::nullopt;
+            }
+            return static_cast<int>(value);
         }
 
         // 返回分析结果
         inline ParseResult makeResult() noexcept {
             switch (_symbol) {
-                case Symbol::INIT: {
-                    // 当流一开始就指向文件尾 返回EOF
-                    if (_ch == -1) {
-                        return { Symbol::SEOF };
-                    }
-                    break;
-                }
                 case Symbol::IDENTIFIER: {
                     // 判断是否保留字
                     if (checkReserved(); _symbol == Symbol::IDENTIFIER) {
-                        return { _symbol, _token };
+                        return { _symbol, std::string(_token) };
                     }
                     return { _symbol };
                 }
@@ -163,145 +642,475 @@ namespace Compiler {
                 case Symbol::INCOMPLETECOMMENT:
                     return { _symbol, "incomplete comment" };
                 case Symbol::UNDEFINED:
-                    return { _symbol , _token };
+                    return { _symbol , std::string(_token) };
                 default:
                     return { _symbol };
             }
         }
 
-        inline auto isSpace() { return _ch == ' '; }
-
-        inline auto isNewLine() { return _ch == '\n' || _ch == '\r'; }
+        // 跳过注释内容 _cur指向"/*"之后
+        // 用memchr找'*' 再看后面是不是'/' 结果与DFA逐字节走注释状态相同
+        inline unsigned char skipComment() {
+            while (true) {
+                auto star = static_cast<const char *>(std::memchr(_cur, '*', _end - _cur));
+                if (star == nullptr) {
+                    // 读到了哨兵
+                    _cur = _end + 1;
+                    return _accept(_A_INCOMPLETECOMMENT);
+                }
 
-        inline auto isTab() { return _ch == '\t'; }
+                _cur = star + 1;
+                while (*_cur == '*') {
+                    ++_cur;
+                }
+                if (*_cur == '/') {
+                    ++_cur;
+                    return _accept(_A_COMMENT);
+                }
+            }
+        }
 
-        inline auto isBlank() { return isSpace() || isNewLine() || isTab(); }
+        // 流模式下每次读入的一行最多这么多字节 更长的行分几次读入
+        static constexpr std::size_t _LINE_LIMIT = 1 << 16;
 
-        inline auto isLetter() { return std::isalpha(_ch); }
+        // 读入流的下一行 接在当前单词之后
+        // 当前单词被缓冲区的末尾截断 之前的内容都已分析完 可以丢掉
+        void refill() {
+            auto from = static_cast<std::size_t>(_token.data() - _begin);
+            if (_symbol == Symbol::INCOMPLETECOMMENT) {
+                // 注释的内容不必重新分析 只留下"/*"和可能与下一行开头的'/'组成"*/"的'*'
+                _owned.resize(_token.size() > 2 && _end[-1] == '*' ? from + 3 : from + 2);
+                _owned.back() = '*';
+            }
+            _owned.erase(0, from);
 
-        inline auto isDigit() { return std::isdigit(_ch); }
+            auto size = _owned.size();
+            _owned.resize(size + _LINE_LIMIT);
+            auto *buffer = _in->rdbuf();
+            while (size < _owned.size()) {
+                auto c = buffer->sbumpc();
+                if (std::char_traits<char>::eq_int_type(c, std::char_traits<char>::eof())) {
+                    _in->setstate(std::ios_base::eofbit);
+                    _in = nullptr;
+                    break;
+                }
+                if ((_owned[size++] = std::char_traits<char>::to_char_type(c)) == '\n') {
+                    break;
+                }
+            }
+            _owned.resize(size);
+            _begin = _cur = _owned.data();
+            _end = _begin + _owned.size();
+        }
 
-        inline auto isColon() { return _ch == ':'; }
+        // 流模式下读完剩下的输入 已分析过的部分不再保留
+        void readAll() {
+            if (_in == nullptr) {
+                return;
+            }
+            _owned.erase(0, static_cast<std::size_t>(_cur - _begin));
+            _owned.append(std::istreambuf_iterator<char>(*_in), std::istreambuf_iterator<char>());
+            _in = nullptr;
+            _begin = _cur = _owned.data();
+            _end = _begin + _owned.size();
+        }
 
-        inline auto isComma() { return _ch == ','; }
+        // [begin, end)之后必须有'\0'哨兵 由调用者保证 不复制输入
+        LexParser(const char *begin, const char *end):
+            _in(nullptr), _begin(begin), _cur(begin), _end(end) { }
 
-        inline auto isSemi() { return _ch == ';'; }
+    public:
+        // 流模式 逐行读入 每读完一个单词就可以返回 交互式输入时不必等到EOF
+        LexParser(std::istream &in = std::cin):
+            _in(&in), _begin(_owned.data()), _cur(_begin), _end(_begin) { }
+        // 复制buffer 任意string_view(包括子串)都可以使用
+        explicit LexParser(std::string_view buffer):
+            _owned(buffer), _in(nullptr), _begin(_owned.data()), _cur(_begin), _end(_begin + _owned.size()) { }
+        // 缓冲区模式 不复制输入 buffer在分析期间必须有效也不能修改
+        // std::string的内容之后总有'\0' 可以直接作为哨兵
+        explicit LexParser(const std::string &buffer):
+            LexParser(buffer.data(), buffer.data() + buffer.size()) { }
+        // 临时的std::string在分析前就会析构
+        LexParser(std::string &&) = delete;
+#ifdef __COMPILER_LEX_PARSER_MMAP_
+        // 缓冲区模式 不复制文件内容 file在分析期间必须有效
+        explicit LexParser(const MappedFile &file):
+            LexParser(file.view().data(), file.view().data() + file.view().size()) { }
+#endif
+        // 持有自己的缓冲区 不能复制或移动
+        LexParser(const LexParser &) = delete;
+        LexParser &operator=(const LexParser &) = delete;
+        ~LexParser() {}
 
-        inline auto isEqu() { return _ch == '='; }
+        ParseResult parseNext() {
+            scanToken();
+            // 流模式下单词读到了缓冲区的末尾 可能被截断 读入下一行后重新分析
+            while (_in != nullptr && _cur >= _end) {
+                refill();
+                scanToken();
+            }
+            return makeResult();
+        }
 
-        inline auto isPlus() { return _ch == '+'; }
+        // parseAll得到的标识符id都在这张表中
+        const InternTable &identifiers() const { return _identifiers; }
 
-        inline auto isMinus() { return _ch == '-'; }
+        // 从当前位置分析到EOF 得到的单词序列与反复调用parseNext相同(不含最后的EOF)
+        // 流模式下先读完剩下的输入 source从第一个未分析的字节开始
+        TokenStream parseAll() {
+            readAll();
+            auto res = TokenStream();
+            res.source = std::string_view(_begin, _end - _begin);
+            // 粗略估计单词数 避免反复扩容
+            auto estimate = static_cast<std::size_t>(_end - _cur) / 8;
+            res.symbols.reserve(estimate);
+            res.offsets.reserve(estimate);
+            res.lengths.reserve(estimate);
 
-        inline auto isDivide() { return _ch == '/'; }
+            parseUntil(res, _end + 1);
+            return res;
+        }
 
-        inline auto isStar() { return _ch == '*'; }
+        /*
+         * 多线程分析 结果与parseAll完全相同
+         * 1. 把剩余的输入分成若干块 第一块由当前线程正常分析
+         * 2. 其余每块推测两次: 从块的开头按不在注释中分析(outside)
+         *    以及假设块的开头在注释中 从之后第一个"*\/"分析(inside) inside与outside的单词起点重合后就停下
+         * 3. 按块的顺序确定拼接方案: 从上一块最后一个单词之后开始 逐个重新分析单词
+         *    直到下一个单词的起点与某个推测中的单词起点重合
+         *    从同一起点出发分析的结果总是相同 所以之后直接采用该推测
+         * 4. 按块的顺序为每块新出现的标识符分配id 再并行地把各块的单词复制到结果中
+         * 推测只影响速度 不影响结果 通常只需重新分析跨过块边界的那一个单词
+         * 实验性接口: 还没有在多核机器上测量过加速比 单核上比parseAll慢 默认应使用parseAll
+         */
+        TokenStream parallelParseAll(unsigned threads = std::thread::hardware_concurrency()) {
+            readAll();
+            auto maxChunks = static_cast<std::size_t>(_end - _cur) / _PARALLEL_MIN_CHUNK;
+            std::size_t chunks = std::min<std::size_t>(std::max(threads, 1u), maxChunks);
+            if (chunks <= 1) {
+                return parseAll();
+            }
 
-        inline auto isLBracket() { return _ch == '('; }
+            // bounds[i]是第i块的开头 最后一块的界限是哨兵之后
+            auto chunkSize = static_cast<std::size_t>(_end - _cur) / chunks;
+            auto bounds = std::vector<const char *>(chunks + 1);
+            for (std::size_t i = 0; i < chunks; ++i) {
+                bounds[i] = _cur + i * chunkSize;
+            }
+            bounds[chunks] = _end + 1;
 
-        inline auto isRBracket() { return _ch == ')'; }
+            auto speculations = std::vector<_Speculation>(chunks);
+            auto res = TokenStream();
+            res.source = std::string_view(_begin, _end - _begin);
+            inParallel(chunks, [&](std::size_t i) {
+                if (i == 0) {
+                    parseUntil(res, bounds[1]);
+                } else {
+                    speculate(speculations[i], bounds[i], bounds[i + 1]);
+                }
+            });
 
-    public:
-        LexParser(std::istream &in = std::cin): _in(in) { }
-        ~LexParser() {}
+            for (std::size_t i = 1; i < chunks; ++i) {
+                plan(speculations[i], bounds[i + 1]);
+            }
 
-        ParseResult parseNext() {
-            init();
+            inParallel(chunks - 1, [&](std::size_t i) {
+                summarize(speculations[i + 1]);
+            });
 
-            try {
-                do {
-                    getChar();
-                } while (isBlank());
-
-                if (isLetter()) {
-                    _symbol = Symbol::IDENTIFIER;
-                    do {
-                        catToken();
-                    } while (isLetter() || isDigit());
-                    ungetChar();
+            // 按顺序分配id 使id与顺序分析时一样按第一次出现编号
+            // 每块的单词数已由各线程统计 这里只求前缀和得到每块在结果中的起始位置
+            auto tokens = res.size(), values = res.values.size(), identifiers = res.identifiers.size();
+            for (std::size_t i = 1; i < chunks; ++i) {
+                auto &spec = speculations[i];
+                for (const auto local: spec.names) {
+                    spec.global[local] = _identifiers.intern(spec.lexer->_identifiers.name(local));
                 }
+                spec.tokenBase = tokens;
+                spec.valueBase = values;
+                spec.identifierBase = identifiers;
+                tokens += spec.tokens;
+                values += spec.values;
+                identifiers += spec.identifiers;
+            }
 
-                else if (isDigit()) {
-                    _symbol = Symbol::INTEGER;
-                    do { catToken(); } while (isDigit());
-                    ungetChar();
-                }
+            res.symbols.resize(tokens);
+            res.offsets.resize(tokens);
+            res.lengths.resize(tokens);
+            res.values.resize(values);
+            res.identifiers.resize(identifiers);
+            inParallel(chunks - 1, [&](std::size_t i) {
+                copyChunk(res, speculations[i + 1]);
+            });
+            return res;
+        }
 
-                else if (isEqu()) {
-                    _symbol = Symbol::EQUAL;
-                }
+    private:
+        // 并行分析时每块的最小字节数 太小的分块不值得开线程
+        static constexpr std::size_t _PARALLEL_MIN_CHUNK = 1 << 16;
+        static constexpr std::size_t _NOT_FOUND = std::numeric_limits<std::size_t>::max();
+        static constexpr std::uint32_t _UNMAPPED = std::numeric_limits<std::uint32_t>::max();
+
+        // 一块上的两种推测 共用一个分析器 标识符id来自它的驻留表
+        struct _Speculation {
+            std::unique_ptr<LexParser> lexer;
+            TokenStream outside, inside;
+            // 推测的单词之后继续分析的位置
+            const char *outsideResume = nullptr, *insideResume = nullptr;
+            // inside汇合到outside的下标
+            std::size_t rejoin = _NOT_FOUND;
 
-                else if (isColon()) {
-                    _symbol = Symbol::COLON;
+            // 拼接方案: 依次是重新分析的head inside[insideFrom..] outside[outsideFrom..]
+            TokenStream head;
+            std::size_t insideFrom = _NOT_FOUND, outsideFrom = _NOT_FOUND;
+            // 方案中的每一段 从stream的第from个单词 第values个整数 第identifiers个标识符开始
+            struct Range {
+                const TokenStream *stream;
+                std::size_t from, values, identifiers;
+            };
+            std::vector<Range> ranges;
+            // 方案中的单词 整数和标识符个数
+            std::size_t tokens = 0, values = 0, identifiers = 0;
+            // 方案中按第一次出现排列的标识符(本地id) 以及本地id → 结果中的id
+            std::vector<std::uint32_t> names, global;
+            // 在结果中的起始位置
+            std::size_t tokenBase = 0, valueBase = 0, identifierBase = 0;
+        };
+
+        // 对0到n-1并行执行f 最后一个在当前线程中执行
+        template <typename F>
+        static void inParallel(std::size_t n, F f) {
+            auto workers = std::vector<std::thread>();
+            for (std::size_t i = 0; i + 1 < n; ++i) {
+                workers.emplace_back(f, i);
+            }
+            if (n != 0) {
+                f(n - 1);
+            }
+            for (auto &t: workers) {
+                t.join();
+            }
+        }
 
-                    if (getChar(); isEqu()) {
-                        _symbol = Symbol::ASSIGN;
+
+        // 从_cur开始确定一块的拼接方案 并把_cur移到这一块最后一个单词之后
+        void plan(_Speculation &spec, const char *limit) {
+            auto &lexer = *spec.lexer;
+            while (true) {
+                auto next = skipRun<_RUN_BLANK>(_cur);
+                if (next >= limit) {
+                    return;
+                }
+
+                auto offset = static_cast<std::size_t>(next - _begin);
+                if (auto j = findToken(spec.outside, offset); j != _NOT_FOUND) {
+                    spec.outsideFrom = j;
+                    _cur = spec.outsideResume;
+                    return;
+                }
+                if (auto j = findToken(spec.inside, offset); j != _NOT_FOUND) {
+                    spec.insideFrom = j;
+                    if (spec.rejoin != _NOT_FOUND) {
+                        spec.outsideFrom = spec.rejoin;
+                        _cur = spec.outsideResume;
                     } else {
-                        ungetChar();
+                        _cur = spec.insideResume;
                     }
+                    return;
                 }
 
-                else if (isPlus()) {
-                    _symbol = Symbol::PLUS;
+                // 没有推测可用 重新分析一个单词
+                lexer._cur = _cur;
+                auto more = lexer.appendNext(spec.head);
+                _cur = lexer._cur;
+                if (!more) {
+                    return;
                 }
+            }
+        }
 
-                else if (isMinus()) {
-                    _symbol = Symbol::MINUS;
+        /*
+         * 在各自的线程中整理一块的拼接方案
+         * 列出方案中的每一段 统计单词 整数和标识符的个数 按第一次出现的顺序收集标识符
+         * 串行的部分只剩下按块求前缀和以及驻留新出现的名字
+         */
+        static void summarize(_Speculation &spec) {
+            auto skipped = [](const TokenStream &stream, std::size_t from, Symbol symbol) {
+                return static_cast<std::size_t>(std::count(stream.symbols.begin(),
+                    stream.symbols.begin() + from, static_cast<std::int8_t>(symbol)));
+            };
+            spec.ranges.push_back({ &spec.head, 0, 0, 0 });
+            for (const auto &[ stream, from ]: { std::make_pair(&spec.inside, spec.insideFrom),
+                std::make_pair(&spec.outside, spec.outsideFrom) }) {
+                if (from != _NOT_FOUND) {
+                    spec.ranges.push_back({ stream, from, skipped(*stream, from, Symbol::INTEGER),
+                        skipped(*stream, from, Symbol::IDENTIFIER) });
                 }
+            }
+
+            auto seen = std::vector<char>(spec.lexer->_identifiers.size(), false);
+            spec.global.assign(seen.size(), _UNMAPPED);
+            for (const auto &range: spec.ranges) {
+                const auto &stream = *range.stream;
+                spec.tokens += stream.size() - range.from;
+                spec.values += stream.values.size() - range.values;
+                spec.identifiers += stream.identifiers.size() - range.identifiers;
+                for (auto k = range.identifiers; k < stream.identifiers.size(); ++k) {
+                    if (auto local = stream.identifiers[k]; !seen[local]) {
+                        seen[local] = true;
+                        spec.names.push_back(local);
+                    }
+                }
+            }
+        }
 
-                else if (isStar()) {
-                    _symbol = Symbol::STAR;
+        // 把一块的方案复制到结果中预留的位置
+        static void copyChunk(TokenStream &res, const _Speculation &spec) {
+            auto token = spec.tokenBase, value = spec.valueBase, identifier = spec.identifierBase;
+            for (const auto &range: spec.ranges) {
+                const auto &stream = *range.stream;
+                std::copy(stream.symbols.begin() + range.from, stream.symbols.end(), res.symbols.begin() + token);
+                std::copy(stream.offsets.begin() + range.from, stream.offsets.end(), res.offsets.begin() + token);
+                std::copy(stream.lengths.begin() + range.from, stream.lengths.end(), res.lengths.begin() + token);
+                std::copy(stream.values.begin() + range.values, stream.values.end(), res.values.begin() + value);
+                for (auto k = range.identifiers; k < stream.identifiers.size(); ++k) {
+                    res.identifiers[identifier++] = spec.global[stream.identifiers[k]];
                 }
+                token += stream.size() - range.from;
+                value += stream.values.size() - range.values;
+            }
+        }
 
-                else if (isLBracket()) {
-                    _symbol = Symbol::LBRACKET;
+        // 把当前单词追加到res 标识符的id来自本分析器的驻留表
+        inline void appendToken(TokenStream &res) {
+            if (_symbol == Symbol::IDENTIFIER) {
+                if (checkReserved(); _symbol == Symbol::IDENTIFIER) {
+                    res.identifiers.push_back(_identifiers.intern(_token));
                 }
+            } else if (_symbol == Symbol::INTEGER) {
+                auto value = parseInteger();
+                res.values.push_back(value.value_or(TokenStream::INTEGER_OVERFLOW));
+            }
+
+            res.symbols.push_back(static_cast<std::int8_t>(_symbol));
+            res.offsets.push_back(static_cast<std::size_t>(_token.data() - _begin));
+            res.lengths.push_back(static_cast<std::uint32_t>(std::min<std::size_t>(
+                _token.size(), std::numeric_limits<std::uint32_t>::max())));
+        }
+
+        // 分析并追加下一个单词 遇到EOF时返回false
+        inline bool appendNext(TokenStream &res) {
+            if (scanToken(); _symbol == Symbol::SEOF) {
+                return false;
+            }
+            appendToken(res);
+            return true;
+        }
 
-                else if (isRBracket()) {
-                    _symbol = Symbol::RBRACKET;
+        // 追加起点在limit之前的单词 停在第一个起点不小于limit的单词之前
+        void parseUntil(TokenStream &res, const char *limit) {
+            while (true) {
+                auto before = _cur;
+                if (scanToken(); _symbol == Symbol::SEOF || _token.data() >= limit) {
+                    _cur = before;
+                    return;
                 }
+                appendToken(res);
+            }
+        }
+
+        // 起点为offset的单词在stream中的下标
+        static std::size_t findToken(const TokenStream &stream, std::size_t offset) {
+            auto it = std::lower_bound(stream.offsets.begin(), stream.offsets.end(), offset);
+            if (it == stream.offsets.end() || *it != offset) {
+                return _NOT_FOUND;
+            }
+            return static_cast<std::size_t>(it - stream.offsets.begin());
+        }
 
-                else if (isComma()) {
-                    _symbol = Symbol::COMMA;
+        // 在[begin, limit)这一块上推测
+        void speculate(_Speculation &spec, const char *begin, const char *limit) const {
+            spec.lexer = std::unique_ptr<LexParser>(new LexParser(_begin, _end));
+            auto &lexer = *spec.lexer;
+
+            lexer._cur = begin;
+            lexer.parseUntil(spec.outside, limit);
+            spec.outsideResume = lexer._cur;
+
+            // 假设begin在注释中 注释在第一个"*\/"处结束 '*'可能恰好在begin之前
+            auto star = begin == _begin ? begin : begin - 1;
+            while (true) {
+                star = static_cast<const char *>(std::memchr(star, '*', _end - star));
+                if (star == nullptr || star >= limit) {
+                    return;
+                }
+                if (*++star == '/') {
+                    break;
                 }
+            }
 
-                else if (isSemi()) {
-                    _symbol = Symbol::SEMI;
+            lexer._cur = star + 1;
+            while (true) {
+                auto before = lexer._cur;
+                if (lexer.scanToken(); lexer._symbol == Symbol::SEOF || lexer._token.data() >= limit) {
+                    spec.insideResume = before;
+                    return;
+                }
+                if (auto j = findToken(spec.outside, lexer._token.data() - _begin); j != _NOT_FOUND) {
+                    spec.rejoin = j;
+                    return;
                 }
+                lexer.appendToken(spec.inside);
+            }
+        }
 
-                else if (isDivide()) {
-                    _symbol = Symbol::DIVIDE;
-                    getChar();
-
-                    if (isStar()) {
-                        _symbol = Symbol::INCOMPLETECOMMENT;
-
-                        do {
-                            do {
-                                getChar();
-                            } while (!isStar());
-                            do {
-                                if (getChar(); isDivide()) {
-                                    return { Symbol::COMMENT };
-                                }
-                            } while (isStar());
-                        } while (!isStar());
-                    } else {
-                        ungetChar();
-                    }
+        // 分析下一个单词 结果存放在_symbol和_token中
+        inline void scanToken() {
+            init();
+
+            _cur = skipRun<_RUN_BLANK>(_cur);
+
+            auto begin = _cur;
+            auto state = _TRANSITIONS[_S_START][classOf(_cur++)];
+            // 标识符和整数的剩余部分整段跳过 DFA只需再读入结束它们的那个字符
+            if (state == _S_IDENTIFIER) {
+                _cur = skipRun<_RUN_ALNUM>(_cur);
+            } else if (state == _S_INTEGER) {
+                _cur = skipRun<_RUN_DIGIT>(_cur);
+            } else if (state == _S_DIVIDE && *_cur == '*') {
+                ++_cur;
+                state = skipComment();
+            }
+
+            while (true) {
+                while (state < _STATE_NUM) {
+                    state = _TRANSITIONS[state][classOf(_cur++)];
                 }
 
-                else {
-                    _symbol = Symbol::UNDEFINED;
-                    _token += _ch;
+                // 读到缓冲区中间的'\0'时 在开始状态是未定义字符 在注释中是普通字符
+                if (auto action = state - _STATE_NUM; action == _A_EOF || action == _A_INCOMPLETECOMMENT) {
+                    if (_cur - 1 != _end) {
+                        if (action == _A_INCOMPLETECOMMENT) {
+                            state = _S_COMMENT;
+                            continue;
+                        }
+                        state = _accept(_A_UNDEFINED);
+                    }
                 }
+                break;
+            }
 
-                return makeResult();
-            } catch (_EOFException &e) {
-                return makeResult();
+            const auto &accept = _ACCEPTS[state - _STATE_NUM];
+            if (accept.retract) {
+                --_cur;
             }
+            _symbol = accept.symbol;
+            _token = std::string_view(begin, _cur - begin);
         }
     };
+
+    inline constexpr LexParser::_ClassTable LexParser::_CLASSES = LexParser::_makeClasses();
+    inline constexpr LexParser::_TransitionTable LexParser::_TRANSITIONS = LexParser::_makeTransitions();
 }
 
 #endif
\ No newline at end of file
@@ -10,6 +10,14 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <iterator>
+#include <vector>
+#include <utility>
+#include <random>
+#include <stdexcept>
+#include <algorithm>
+#include <cctype>
 #include "../LexParser.h"
 #include "../../../include/catch.hpp"
 
@@ -19,10 +27,7 @@ using namespace Compiler;
 const string TEST_FILE_PATH = "compiler-principle/oj/LexParser/test/l";
 const int TEST_FILE_TOTAL = 8;
 
-string parse(int no) {
-    auto inFile = ifstream(TEST_FILE_PATH + to_string(no) + "/in.txt");
-
-    auto parser = LexParser(inFile);
+string dump(LexParser &parser) {
     ostringstream ss;
 
     while (true) {
@@ -54,6 +59,197 @@ string parse(int no) {
         return ss.str();
 }
 
+// 与dump相同的输出格式
+string dump(const TokenStream &stream) {
+    ostringstream ss;
+    auto value = stream.values.begin();
+
+    for (size_t i = 0; i < stream.size(); ++i) {
+        switch (auto symbol = stream.symbol(i); symbol) {
+            case Symbol::IDENTIFIER:
+                ss << symbol << ' ' << stream.text(i) << '\n';
+                break;
+            case Symbol::INTEGER: {
+                ss << symbol << ' ';
+                *value == TokenStream::INTEGER_OVERFLOW ? (ss << "OF") : (ss << *value);
+                ss << '\n';
+                ++value;
+                break;
+            }
+            case Symbol::INCOMPLETECOMMENT:
+                ss << symbol << " incomplete comment\n";
+                break;
+            case Symbol::COMMENT:
+                break;
+            case Symbol::UNDEFINED:
+                ss << -1 << ' ' << stream.text(i) << '\n';
+                return ss.str();
+            default:
+                ss << symbol << '\n';
+        }
+    }
+    return ss.str();
+}
+
+// 逐字符实现的词法分析 作为随机测试的参照 输出格式与dump相同
+string reference(const string &input) {
+    const auto words = vector<string>({ "BEGIN", "END", "IF", "THEN", "ELSE" });
+    const auto singles = string("=+-*(),;");
+    const auto codes = vector<int>({ 32, 22, 23, 24, 26, 27, 28, 29 });
+    ostringstream ss;
+
+    for (size_t i = 0; i < input.size(); ) {
+        auto ch = input[i];
+        if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
+            ++i;
+        } else if (isalpha(static_cast<unsigned char>(ch))) {
+            auto j = i;
+            while (j < input.size() && isalnum(static_cast<unsigned char>(input[j]))) {
+                ++j;
+            }
+            auto word = input.substr(i, j - i);
+            auto it = find(words.begin(), words.end(), word);
+            it == words.end() ? (ss << "20 " << word) : (ss << it - words.begin() + 1);
+            ss << '\n';
+            i = j;
+        } else if (isdigit(static_cast<unsigned char>(ch))) {
+            auto j = i;
+            while (j < input.size() && isdigit(static_cast<unsigned char>(input[j]))) {
+                ++j;
+            }
+            auto digits = input.substr(i, j - i);
+            digits.erase(0, min(digits.find_first_not_of('0'), digits.size() - 1));
+            auto overflow = digits.size() > 10 || (digits.size() == 10 && digits > "2147483647");
+            ss << "21 " << (overflow ? "OF" : digits) << '\n';
+            i = j;
+        } else if (ch == ':') {
+            auto assign = i + 1 < input.size() && input[i + 1] == '=';
+            ss << (assign ? 31 : 30) << '\n';
+            i += assign ? 2 : 1;
+        } else if (ch == '/' && i + 1 < input.size() && input[i + 1] == '*') {
+            auto close = input.find("*/", i + 2);
+            if (close == string::npos) {
+                ss << "-1 incomplete comment\n";
+                break;
+            }
+            i = close + 2;
+        } else if (ch == '/') {
+            ss << 25 << '\n';
+            ++i;
+        } else if (auto k = singles.find(ch); k != string::npos) {
+            ss << codes[k] << '\n';
+            ++i;
+        } else {
+            ss << "-1 " << ch << '\n';
+            break;
+        }
+    }
+    return ss.str();
+}
+
+namespace Compiler {
+    // 直接调用LexParser的私有内核 不受本机CPU选择的内核限制
+    struct LexParserTest {
+        // 第二个参数是哨兵的下一个位置 内核的向量读入不能越过它
+        using Kernel = const char *(*)(const char *, const char *);
+
+        // 本机支持的所有跳过串的内核
+        template <LexParser::_Run run>
+        static vector<pair<string, Kernel> > kernels() {
+            auto scalar = [](const char *p, const char *) { return LexParser::skipRunScalar<run>(p); };
+            auto res = vector<pair<string, Kernel> >({ { "scalar", scalar } });
+#ifdef __COMPILER_LEX_PARSER_X86_
+            if (LexParser::hasAVX2()) {
+                res.emplace_back("avx2", LexParser::skipRunAVX2<run>);
+            }
+            if (LexParser::hasSSE42()) {
+                res.emplace_back("sse4.2", LexParser::skipRunSSE42<run>);
+            }
+#endif
+            return res;
+        }
+
+        // 每个起始偏移0-63 每个长度0-80的串 后面紧跟一个终止字符
+        // 终止字符之后仍是串中的字符 内核必须恰好停在终止字符上
+        // limit取终止字符的下一个位置 向量读入之后的逐字节尾部也会被覆盖
+        template <LexParser::_Run run>
+        static void checkRun(const string &members, const string &stoppers) {
+            alignas(64) char buffer[256];
+            auto rng = mt19937(run);
+            for (const auto &[ name, kernel ]: kernels<run>()) {
+                CAPTURE(name);
+                for (int offset = 0; offset < 64; ++offset) {
+                    for (int len = 0; len <= 80; ++len) {
+                        for (const auto stop: stoppers) {
+                            for (auto &ch: buffer) {
+                                ch = members[rng() % members.size()];
+                            }
+                            buffer[offset + len] = stop;
+                            buffer[sizeof(buffer) - 1] = '\0';
+                            CAPTURE(offset, len, static_cast<int>(stop));
+                            REQUIRE(kernel(buffer + offset, buffer + offset + len + 1) == buffer + offset + len);
+                        }
+                    }
+                }
+            }
+        }
+
+#ifdef __COMPILER_LEX_PARSER_MMAP_
+        // 哨兵是一页的最后一个字节 下一页不可访问
+        // 内核读到哨兵为止 不能因为向量读入越过哨兵而访问下一页
+        template <LexParser::_Run run>
+        static void checkGuardPageRun(char *end, const string &members) {
+            for (const auto &[ name, kernel ]: kernels<run>()) {
+                CAPTURE(name);
+                for (int len = 0; len <= 100; ++len) {
+                    for (auto i = 0; i < len; ++i) {
+                        end[i - len] = members[i % members.size()];
+                    }
+                    CAPTURE(len);
+                    REQUIRE(kernel(end - len, end + 1) == end);
+                }
+            }
+        }
+
+        static void checkGuardPage(char *end) {
+            checkGuardPageRun<LexParser::_RUN_ALNUM>(end, "azAZ09mQ5");
+            checkGuardPageRun<LexParser::_RUN_DIGIT>(end, "0123456789");
+            checkGuardPageRun<LexParser::_RUN_BLANK>(end, " \t\n\r");
+        }
+#endif
+
+        static void checkKernels() {
+            checkRun<LexParser::_RUN_ALNUM>("azAZ09mQ5", string("\0 @[`{/:\xc1\xfa", 11));
+            checkRun<LexParser::_RUN_DIGIT>("0123456789", string("\0/:a ", 5));
+            checkRun<LexParser::_RUN_BLANK>(" \t\n\r", string("\0\x0b\x0c\x1f!a", 6));
+        }
+
+        static unique_ptr<LexParser> over(const char *begin, const char *end) {
+            return unique_ptr<LexParser>(new LexParser(begin, end));
+        }
+    };
+}
+
+// 注释内容 含有'*'和'/'但不含"*/"
+string randomComment(size_t len, mt19937 &rng) {
+    const auto alphabet = string("ab1 */\n");
+    auto res = string();
+    for (size_t i = 0; i < len; ++i) {
+        auto ch = alphabet[rng() % alphabet.size()];
+        if (ch == '/' && !res.empty() && res.back() == '*') {
+            ch = ' ';
+        }
+        res += ch;
+    }
+    return res;
+}
+
+string parse(int no) {
+    auto inFile = ifstream(TEST_FILE_PATH + to_string(no) + "/in.txt");
+    auto parser = LexParser(inFile);
+    return dump(parser);
+}
+
 string ans(int no) {
     auto ansFile = ifstream(TEST_FILE_PATH + to_string(no) + "/ans.txt");
     ostringstream ss;
@@ -70,4 +266,291 @@ TEST_CASE("Lexical Parser", "[lex]") {
     for (int i = 1; i <= TEST_FILE_TOTAL; ++i) {
         REQUIRE(parse(i) == ans(i));
     }
+
+    SECTION("Buffer mode") {
+        for (int i = 1; i <= TEST_FILE_TOTAL; ++i) {
+            auto path = TEST_FILE_PATH + to_string(i) + "/in.txt";
+            auto inFile = ifstream(path);
+            auto content = string(istreambuf_iterator<char>(inFile), istreambuf_iterator<char>());
+
+            auto parser = LexParser(content);
+            REQUIRE(dump(parser) == ans(i));
+
+#ifdef __COMPILER_LEX_PARSER_MMAP_
+            auto file = MappedFile(path);
+            auto mapped = LexParser(file);
+            REQUIRE(dump(mapped) == ans(i));
+#endif
+        }
+
+        // 不以'\0'结尾的string_view会被复制 分析到view的末尾为止
+        const auto source = string("BEGIN x12 := 345; END");
+        for (size_t len = 0; len <= source.size(); ++len) {
+            auto prefix = LexParser(string_view(source).substr(0, len));
+            auto copied = string(source, 0, len);
+            auto expected = LexParser(copied);
+            REQUIRE(dump(prefix) == dump(expected));
+        }
+    }
+
+    SECTION("Token stream") {
+        for (int i = 1; i <= TEST_FILE_TOTAL; ++i) {
+            auto inFile = ifstream(TEST_FILE_PATH + to_string(i) + "/in.txt");
+            auto parser = LexParser(inFile);
+            auto stream = parser.parseAll();
+            REQUIRE(dump(stream) == ans(i));
+            REQUIRE(parser.parseNext().symbol == Symbol::SEOF);
+        }
+    }
+
+    SECTION("Integer overflow") {
+        // 用std::stoi作为参照
+        auto oracle = [](const string &digits) {
+            try {
+                return to_string(stoi(digits));
+            } catch (out_of_range &) {
+                return string("OF");
+            }
+        };
+
+        auto inputs = vector<string>({
+            "0", "000", "7", "12345678", "123456789", "2147483647", "2147483648",
+            "4294967295", "4294967296", "9999999999", "99999999999",
+            "00000000002147483647", "00000000002147483648", string(40, '9'), string(30, '0') + "1",
+        });
+        auto rng = mt19937(1);
+        for (int i = 0; i < 2000; ++i) {
+            auto digits = string(rng() % 4, '0');
+            for (auto len = rng() % 13 + 1; len > 0; --len) {
+                digits += static_cast<char>('0' + rng() % 10);
+            }
+            inputs.push_back(digits);
+        }
+
+        for (const auto &digits: inputs) {
+            auto parser = LexParser(digits);
+            REQUIRE(dump(parser) == "21 " + oracle(digits) + "\n");
+        }
+    }
+
+    SECTION("Reserved words") {
+        REQUIRE(reserved.find("BEGIN") == Symbol::BEGIN);
+        REQUIRE(reserved.find("END") == Symbol::END);
+        REQUIRE(reserved.find("IF") == Symbol::IF);
+        REQUIRE(reserved.find("THEN") == Symbol::THEN);
+        REQUIRE(reserved.find("ELSE") == Symbol::ELSE);
+        // 长度 首尾字符相同或槽位相同的非保留字
+        for (const auto word: { "", "B", "BEGIN1", "BEGAN", "BEGIn", "EBD", "ENDD", "If", "IN",
+            "THEM", "TEEN", "ELSF", "ESSE", "begin", "ELSEIF" }) {
+            REQUIRE_FALSE(reserved.find(word).has_value());
+        }
+    }
+
+    SECTION("Identifier interning") {
+        const auto source = string("a BEGIN bb a1 a bb := ccc a1 END a");
+        auto parser = LexParser(source);
+        auto stream = parser.parseAll();
+        const auto &table = parser.identifiers();
+
+        // id按第一次出现的顺序连续编号 保留字不进入驻留表
+        REQUIRE(stream.identifiers == vector<uint32_t>({ 0, 1, 2, 0, 1, 3, 2, 0 }));
+        REQUIRE(table.size() == 4);
+        auto k = size_t(0);
+        for (size_t i = 0; i < stream.size(); ++i) {
+            if (stream.symbol(i) == Symbol::IDENTIFIER) {
+                REQUIRE(table.name(stream.identifiers[k++]) == stream.text(i));
+            }
+        }
+
+        // 扩容和arena分块之后 已有的id和名字不变
+        auto names = InternTable();
+        for (int i = 0; i < 100000; ++i) {
+            REQUIRE(names.intern("name" + to_string(i)) == static_cast<uint32_t>(i));
+        }
+        REQUIRE(names.intern(string(100000, 'x')) == 100000);
+        for (int i = 0; i < 100000; i += 997) {
+            REQUIRE(names.intern("name" + to_string(i)) == static_cast<uint32_t>(i));
+            REQUIRE(names.name(i) == "name" + to_string(i));
+        }
+        REQUIRE(names.size() == 100001);
+    }
+
+    SECTION("Parallel lexing") {
+        // 长注释会跨过多个分块 也有跨过块边界的单词和不完整的注释
+        const auto pieces = vector<string>({
+            "BEGIN", "END", "IF", "x1", "counter", "2147483648", "42", ":=", ":", "/", "*", "(", ";",
+            "/* short */", "/*/ tricky **/", "*/", "\n\t ", "#",
+        });
+        for (unsigned seed = 0; seed < 6; ++seed) {
+            auto rng = mt19937(seed);
+            auto input = string();
+            while (input.size() < (1 << 19)) {
+                if (rng() % 500 == 0) {
+                    input += "/*" + randomComment(rng() % (1 << 18), rng) + "*/";
+                } else {
+                    input += pieces[rng() % pieces.size()] + ' ';
+                }
+            }
+            if (seed % 2) {
+                input += "/* incomplete";
+            }
+
+            auto sequential = LexParser(input);
+            auto expected = sequential.parseAll();
+            for (unsigned threads: { 2, 3, 8 }) {
+                auto parallel = LexParser(input);
+                auto actual = parallel.parallelParseAll(threads);
+                REQUIRE(actual.symbols == expected.symbols);
+                REQUIRE(actual.offsets == expected.offsets);
+                REQUIRE(actual.lengths == expected.lengths);
+                REQUIRE(actual.values == expected.values);
+                REQUIRE(actual.identifiers == expected.identifiers);
+                REQUIRE(parallel.identifiers().size() == sequential.identifiers().size());
+                REQUIRE(parallel.parseNext().symbol == Symbol::SEOF);
+            }
+        }
+    }
+
+    SECTION("End of input") {
+        const auto cases = vector<pair<string, string> >({
+            { "", "" },
+            { " \n\t", "" },
+            { "BEGIN", "1\n" },
+            { "abc12", "20 abc12\n" },
+            { "2147483648", "21 OF\n" },
+            { "a:", "20 a\n30\n" },
+            { "a/", "20 a\n25\n" },
+            { "/* a *", "-1 incomplete comment\n" },
+            { "/* a **/", "" },
+            { "/*/ */a/***/", "20 a\n" },
+            { "/**", "-1 incomplete comment\n" },
+            { "/* */ */", "24\n25\n" },
+        });
+        for (const auto &[ input, expected ]: cases) {
+            auto parser = LexParser(input);
+            REQUIRE(dump(parser) == expected);
+            // EOF之后继续调用仍然返回EOF
+            REQUIRE(parser.parseNext().symbol == Symbol::SEOF);
+        }
+
+        // 缓冲区中间的'\0'不是EOF
+        auto input = string("a\0b", 3);
+        auto parser = LexParser(input);
+        REQUIRE(dump(parser) == string("20 a\n-1 \0\n", 10));
+        auto comment = string("/* \0 **\0*/b /* \0", 16);
+        auto commentParser = LexParser(comment);
+        REQUIRE(dump(commentParser) == "20 b\n-1 incomplete comment\n");
+    }
+
+    SECTION("Comments") {
+        // 注释在EOF处没有结束 '*'紧挨着哨兵 长度跨过memchr和SIMD的各种边界
+        for (int len = 0; len <= 80; ++len) {
+            const auto body = string(len, len % 3 ? 'a' : '/');
+            for (const auto &input: { "/*" + body, "/*" + body + "*", "/*" + body + "**",
+                "x/*" + body + "*", "/*" + string(len, '*'), "/*" + body + "*/*" }) {
+                auto parser = LexParser(input);
+                REQUIRE(dump(parser) == reference(input));
+                REQUIRE(parser.parseNext().symbol == Symbol::SEOF);
+                auto batch = LexParser(input);
+                REQUIRE(dump(batch.parseAll()) == reference(input));
+            }
+        }
+
+        // 与逐字符实现随机对照 字符集偏向注释的边界情况
+        auto rng = mt19937(3);
+        const auto alphabet = string("ab1 */:=\n;*/");
+        for (int i = 0; i < 3000; ++i) {
+            auto input = string();
+            for (auto len = rng() % 200; len > 0; --len) {
+                input += rng() % 500 == 0 ? '#' : alphabet[rng() % alphabet.size()];
+            }
+            auto parser = LexParser(input);
+            REQUIRE(dump(parser) == reference(input));
+            auto batch = LexParser(input);
+            REQUIRE(dump(batch.parseAll()) == reference(input));
+        }
+    }
+
+    SECTION("Streaming input") {
+        // 逐行读入 返回一个单词时还没有读入之后的行
+        auto in = istringstream("BEGIN x\n/* a\n*/ 12 :\n= END\n");
+        auto parser = LexParser(in);
+        REQUIRE(parser.parseNext().symbol == Symbol::BEGIN);
+        REQUIRE(in.tellg() == 8);
+        REQUIRE(parser.parseNext().symbol == Symbol::IDENTIFIER);
+        REQUIRE(in.tellg() == 8);
+        REQUIRE(parser.parseNext().symbol == Symbol::COMMENT);
+        REQUIRE(parser.parseNext().getNum() == 12);
+        REQUIRE(in.tellg() == 21);
+        REQUIRE(parser.parseNext().symbol == Symbol::COLON);
+        REQUIRE(parser.parseNext().symbol == Symbol::EQUAL);
+        REQUIRE(parser.parseNext().symbol == Symbol::END);
+        REQUIRE(parser.parseNext().symbol == Symbol::SEOF);
+
+        // 跨行的单词和超过一次读入长度的行 结果与缓冲区模式相同
+        auto rng = mt19937(4);
+        const auto alphabet = string("ab1 */:=\n;*/");
+        auto inputs = vector<string>({ string(100000, 'a') + "\n1", string(70000, '9') + ":=",
+            "/*" + string(70000, '*') + "/x", "/*" + string(65534, 'a') + "*" + "/b/*\n" + string(65536, '\n') });
+        for (int i = 0; i < 2000; ++i) {
+            auto input = string();
+            for (auto len = rng() % 200; len > 0; --len) {
+                input += rng() % 500 == 0 ? '#' : rng() % 1000 == 0 ? '\0' : alphabet[rng() % alphabet.size()];
+            }
+            inputs.push_back(input);
+        }
+        for (const auto &input: inputs) {
+            auto stream = istringstream(input);
+            auto streamed = LexParser(stream);
+            auto buffered = LexParser(input);
+            REQUIRE(dump(streamed) == dump(buffered));
+        }
+
+        // 分析了一部分之后parseAll读完剩下的输入
+        auto rest = istringstream("a\nb c\n/* d */ 1\n");
+        auto partial = LexParser(rest);
+        REQUIRE(partial.parseNext().getMsg() == "a");
+        REQUIRE(dump(partial.parseAll()) == "20 b\n20 c\n21 1\n");
+    }
+
+    SECTION("SIMD kernels") {
+        using Test = LexParserTest;
+        Test::checkKernels();
+
+#ifdef __COMPILER_LEX_PARSER_MMAP_
+        auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        auto base = static_cast<char *>(mmap(nullptr, 2 * page, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        REQUIRE(base != MAP_FAILED);
+        REQUIRE(mprotect(base + page, page, PROT_NONE) == 0);
+        auto end = base + page - 1;
+        *end = '\0';
+        Test::checkGuardPage(end);
+
+        // 整个分析器在紧挨着不可访问页的缓冲区上运行
+        auto rng = mt19937(7);
+        const auto alphabet = string("ab1 \t*/:=;");
+        for (int len = 0; len <= 200; ++len) {
+            for (auto p = end - len; p != end; ++p) {
+                *p = alphabet[rng() % alphabet.size()];
+            }
+            auto parser = Test::over(end - len, end);
+            REQUIRE(dump(*parser) == reference(string(end - len, end)));
+        }
+        munmap(base, 2 * page);
+#endif
+    }
+
+    SECTION("Long runs") {
+        // 跨过16和32字节边界的标识符 整数和空白
+        auto input = string(), expected = string();
+        for (int len = 1; len <= 80; ++len) {
+            auto identifier = string(len, 'a') + to_string(len % 10);
+            auto integer = string(len, '0') + to_string(len);
+            input += identifier + string(len, len % 2 ? ' ' : '\t') + integer + string(len, '\n') + ";";
+            expected += "20 " + identifier + "\n21 " + to_string(len) + "\n29\n";
+        }
+        auto parser = LexParser(input);
+        REQUIRE(dump(parser) == expected);
+    }
 }
@@ -9,9 +9,9 @@
 
 #include <iostream>
 #include <string>
-#include <unordered_map>
 #include <utility>
 #include <cctype>
+#include "../ReservedWords.h"
 
 namespace Compiler {
     // 类别表
@@ -33,18 +33,19 @@ namespace Compiler {
     };
 
     // 保留字表
-    const auto reserved = std::unordered_map<std::string, Symbol>({
+    inline constexpr auto reserved = ReservedWords<Symbol, 3>({
         { "IF",     Symbol::IF },
         { "THEN",   Symbol::THEN },
         { "ELSE",   Symbol::ELSE },
     });
 
     // 词法分析器
+    // 逐行读入缓冲区 末尾的'\0'作为哨兵 EOF不使用异常
     class Lex {
     private:
-        class EOFException {};
-
-        std::istream &_in;
+        std::string _buffer;
+        std::istream *_in;      // 还没有读完的流 读完后为nullptr
+        const char *_cur;
         std::string _token;
         int _ch;
         Symbol &_symbol;
@@ -54,14 +55,32 @@ namespace Compiler {
             _symbol = Symbol::INIT;
         }
 
+        // 刚读过的是末尾的哨兵
+        inline auto _isEnd() { return _cur == _buffer.data() + _buffer.size() + 1; }
+
+        // 读入流的下一行 之前的内容都已读过 不再保留
+        void _refill() {
+            if (!std::getline(*_in, _buffer) || _in->eof()) {
+                _in = nullptr;
+            } else {
+                _buffer += '\n';
+            }
+            _cur = _buffer.data();
+        }
+
+        // 读到哨兵之后必须_unget 保证不越过哨兵
+        // 流还没有读完时 哨兵只是这一行的末尾 读入下一行再读
         inline void _get() {
-            _ch = _in.get();
-            if (_in.eof()) {
-                throw EOFException();
+            if (_ch = static_cast<unsigned char>(*_cur++); _ch == '\0' && _in != nullptr && _isEnd()) {
+                _refill();
+                _ch = static_cast<unsigned char>(*_cur++);
             }
         }
 
-        inline void _unget() { _in.unget(); }
+        inline void _unget() { --_cur; }
+
+        // 缓冲区中间的'\0'不是EOF
+        inline auto _isEOF() { return _ch == '\0' && _isEnd(); }
 
         inline auto _isSpace() { return _ch == ' '; }
 
@@ -90,81 +109,74 @@ namespace Compiler {
         inline auto _isEqu() { return _ch == '='; }
 
     public:
-        Lex(std::istream &in, Symbol &symbol) : _in(in), _symbol(symbol) {}
+        Lex(std::istream &in, Symbol &symbol) :
+            _in(&in), _cur(_buffer.data()), _symbol(symbol) {}
+        Lex(const Lex &) = delete;
+        Lex &operator=(const Lex &) = delete;
         ~Lex() = default;
 
         void _next() {
             _init();
 
-            try {
+            do {
+                _get();
+            } while (_isBlank());
+
+            if (_isEOF()) {
+                _unget();
+                _symbol = Symbol::SEOF;
+                return;
+            }
+
+            if (_isAlpha()) {
+                _symbol = Symbol::IDENTIFIER;
                 do {
+                    _token += _ch;
                     _get();
-                } while (_isBlank());
-
-                if (_isAlpha()) {
-                    _symbol = Symbol::IDENTIFIER;
-                    do {
-                        _token += _ch;
-                        _get();
-                    } while (_isAlpha());
-                    _unget();
-
-                    if (auto it = reserved.find(_token); it != reserved.end()) {
-                        _symbol = it->second;
-                    }
-                }
+                } while (_isAlpha());
+                _unget();
 
-                else if (_isLParent()) {
-                    _symbol = Symbol::LPARENT;
+                if (auto res = reserved.find(_token); res.has_value()) {
+                    _symbol = res.value();
                 }
+            }
 
-                else if (_isRParent()) {
-                    _symbol = Symbol::RPARENT;
-                }
+            else if (_isLParent()) {
+                _symbol = Symbol::LPARENT;
+            }
 
-                else if (_isLBracket()) {
-                    _symbol = Symbol::LBRACKET;
-                }
+            else if (_isRParent()) {
+                _symbol = Symbol::RPARENT;
+            }
 
-                else if (_isRBracket()) {
-                    _symbol = Symbol::RBRACKET;
-                }
+            else if (_isLBracket()) {
+                _symbol = Symbol::LBRACKET;
+            }
 
-                else if (_isPlus()) {
-                    _symbol = Symbol::PLUS;
-                }
+            else if (_isRBracket()) {
+                _symbol = Symbol::RBRACKET;
+            }
 
-                else if (_isStar()) {
-                    _symbol = Symbol::MULTI;
-                }
+            else if (_isPlus()) {
+                _symbol = Symbol::PLUS;
+            }
 
-                else if (_isColon()) {
-                    _symbol = Symbol::UNDEFINED;
+            else if (_isStar()) {
+                _symbol = Symbol::MULTI;
+            }
 
-                    if (_get(); _isEqu()) {
-                        _symbol = Symbol::ASSIGN;
-                    } else {
-                        _unget();
-                    }
-                }
+            else if (_isColon()) {
+                _symbol = Symbol::UNDEFINED;
 
-                else {
-                    _symbol = Symbol::UNDEFINED;
+                if (_get(); _isEqu()) {
+                    _symbol = Symbol::ASSIGN;
+                } else {
+                    _unget();
                 }
+            }
 
-            } catch (EOFException &e) {
-                switch (_symbol) {
-                    case Symbol::INIT: {
-                        _symbol = Symbol::SEOF;
-                        break;
-                    }
-                    case Symbol::IDENTIFIER: {
-                        if (auto it = reserved.find(_token); it != reserved.end()) {
-                            _symbol = it->second;
-                        }
-                        break;
-                    }
-                }
+            else {
+                _symbol = Symbol::UNDEFINED;
             }
         }
     };
@@ -8,14 +8,17 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <vector>
+#include <utility>
 #include "../../../include/catch.hpp"
 #include "../RDP.h"
 
 using namespace std;
 using namespace Compiler;
 
-const string TEST_FILE_PATH = "compiler-principle/oj/Parser/test/p";
+const string TEST_FILE_PATH = "compiler-principle/oj/RDP/test/p";
 const int TEST_FILE_TOTAL = 5;
 
 bool parse(int no) {
@@ -28,6 +31,8 @@ bool ans(int no) {
     auto ansFile = ifstream(TEST_FILE_PATH + to_string(no) + "/ans.txt");
     string res = "";
     ansFile >> res;
+    // 找不到测试文件时不能当作F通过
+    REQUIRE((res == "T" || res == "F"));
     return res == "T";
 }
 
@@ -35,4 +40,43 @@ TEST_CASE("Recursive Descent Parser", "[rdp]") {
     for (int i = 1; i <= TEST_FILE_TOTAL; ++i) {
         REQUIRE(parse(i) == ans(i));
     }
+
+    SECTION("End of input") {
+        // EOF紧跟在最后一个单词之后 缓冲区中间的'\0'是未定义字符
+        const auto cases = vector<pair<string, bool> >({
+            { "", false },
+            { "a", false },
+            { "a:", false },
+            { "a:=", false },
+            { "a:=b", true },
+            { "a[b]:=(c", false },
+            { "a[b]:=(c)", true },
+            { "IF a THEN b:=c", true },
+            { "IF a THEN b:=c ELSE", false },
+            { "IF", false },
+            { string("a:=\0b", 5), false },
+            { string("a\0:=b", 5), false },
+            { string("a[\0]:=b", 7), false },
+            { string("\0", 1), false },
+        });
+        for (const auto &[ input, expected ]: cases) {
+            auto in = istringstream(input);
+            auto parser = RDP(in);
+            CAPTURE(input);
+            REQUIRE(parser.parse() == expected);
+        }
+    }
+
+    SECTION("Streaming input") {
+        // 逐行读入 出错时不必读完之后的行
+        auto in = istringstream("a +\nb := c\n");
+        auto parser = RDP(in);
+        REQUIRE_FALSE(parser.parse());
+        REQUIRE(in.tellg() == 4);
+
+        // 语句可以跨行 最后一行没有换行符
+        auto multiline = istringstream("IF a\n THEN\r\nb[c] :=\n\n(d+e)*f");
+        auto statement = RDP(multiline);
+        REQUIRE(statement.parse());
+    }
 }
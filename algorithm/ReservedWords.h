@@ -0,0 +1,93 @@
+/*
+ * ReservedWords.h
+ * Compile-time perfect hash of reserved words shared by the parsers.
+ * Copyright (c) zx5. All rights reserved.
+ */
+
+#ifndef __COMPILER_RESERVED_WORDS_
+#define __COMPILER_RESERVED_WORDS_
+
+#include <string_view>
+#include <array>
+#include <optional>
+#include <utility>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace Compiler {
+    // 保留字的完美哈希 在编译期生成
+    // 槽位只由长度 首字符和末字符决定 命中后再用memcmp比较整个串
+    // 长度不在保留字长度范围内的标识符不必计算哈希
+    // Symbol是各个分析器自己的类别表
+    template <typename Symbol, std::size_t N>
+    class ReservedWords {
+    private:
+        static constexpr std::size_t _TABLE_SIZE = 16;
+        static_assert(N <= _TABLE_SIZE, "too many reserved words");
+
+        std::array<std::string_view, N> _words {};
+        std::array<Symbol, N> _symbols {};
+        // 槽位 → 保留字下标 -1表示空
+        std::array<signed char, _TABLE_SIZE> _slots {};
+        unsigned _seed = 0;
+        std::size_t _minLength = 0, _maxLength = 0;
+
+        static constexpr std::size_t _slot(std::size_t length, unsigned char first,
+            unsigned char last, unsigned seed) {
+            return ((first * seed + last) ^ (length * 5)) & (_TABLE_SIZE - 1);
+        }
+
+        constexpr std::size_t _slot(std::string_view word, unsigned seed) const {
+            return _slot(word.size(), word.front(), word.back(), seed);
+        }
+
+        // 用seed填充槽位 有冲突时返回false
+        constexpr bool _build(unsigned seed) {
+            for (auto &slot: _slots) {
+                slot = -1;
+            }
+            for (std::size_t i = 0; i < N; ++i) {
+                auto &slot = _slots[_slot(_words[i], seed)];
+                if (slot != -1) {
+                    return false;
+                }
+                slot = static_cast<signed char>(i);
+            }
+            return true;
+        }
+
+    public:
+        constexpr ReservedWords(const std::pair<std::string_view, Symbol> (&words)[N]) {
+            _minLength = words[0].first.size();
+            for (std::size_t i = 0; i < N; ++i) {
+                _words[i] = words[i].first;
+                _symbols[i] = words[i].second;
+                _minLength = std::min(_minLength, _words[i].size());
+                _maxLength = std::max(_maxLength, _words[i].size());
+            }
+
+            // 找不到完美哈希时在编译期报错
+            for (_seed = 1; !_build(_seed); ++_seed) {
+                if (_seed == 1 << 16) {
+                    throw std::logic_error("no perfect hash for reserved words");
+                }
+            }
+        }
+
+        // 不是保留字时返回std::nullopt
+        std::optional<Symbol> find(std::string_view word) const {
+            if (word.size() < _minLength || word.size() > _maxLength) {
+                return std::nullopt;
+            }
+            auto i = _slots[_slot(word, _seed)];
+            if (i == -1 || _words[i].size() != word.size()
+                || std::memcmp(_words[i].data(), word.data(), word.size()) != 0) {
+                return std::nullopt;
+            }
+            return _symbols[i];
+        }
+    };
+}
+
+#endif